@@ -0,0 +1,109 @@
+// CommandRing.cpp
+
+#include "stdafx.h"
+#include "CommandRing.h"
+#include <stdarg.h>
+#include <string.h>
+
+CCommandRing::CCommandRing() {
+	Clear();
+}
+
+int CCommandRing::FindRoom() const {
+	if (this->m_queued - this->m_done >= COMMAND_RING_MAX_COMMANDS) {
+		return -1;
+	}
+	if (this->m_queued == this->m_done) {
+		return 0;
+	}
+
+	// Commands never wrap, each one is in one piece so it can be sent as is
+	int write = this->m_write;
+	int oldest = this->m_commands[this->m_done % COMMAND_RING_MAX_COMMANDS].offset;
+	if (write >= oldest) {
+		if (write + COMMAND_MAX_LENGTH <= COMMAND_RING_SIZE) {
+			return write;
+		}
+		return (COMMAND_MAX_LENGTH < oldest) ? 0 : -1;
+	}
+	return (write + COMMAND_MAX_LENGTH < oldest) ? write : -1;
+}
+
+bool CCommandRing::Format(const char * format, ...) {
+	int write = FindRoom();
+	if (write < 0) {
+		return false;
+	}
+
+	va_list args;
+	va_start(args, format);
+	int length = _vsnprintf_s(this->m_buffer + write, COMMAND_MAX_LENGTH - COMMAND_TERMINATOR_LENGTH, _TRUNCATE, format, args);
+	va_end(args);
+	if (length < 0) {
+		printf("Error: Command is longer than %d characters\n", COMMAND_MAX_LENGTH - COMMAND_TERMINATOR_LENGTH - 1);
+		return false;
+	}
+	memcpy(this->m_buffer + write + length, COMMAND_TERMINATOR, COMMAND_TERMINATOR_LENGTH);
+	length += COMMAND_TERMINATOR_LENGTH;
+
+	Command & command = this->m_commands[this->m_queued % COMMAND_RING_MAX_COMMANDS];
+	command.offset = write;
+	command.length = length;
+	this->m_queued++;
+	this->m_write = write + length;
+	return true;
+}
+
+int CCommandRing::GetUnsentSpan(int maxCommands, const char ** span, int * length) const {
+	*span = NULL;
+	*length = 0;
+	int commands = 0;
+	int next = 0;
+	for (unsigned long number = this->m_sent; number != this->m_queued && commands < maxCommands; number++) {
+		const Command & command = this->m_commands[number % COMMAND_RING_MAX_COMMANDS];
+		if (commands == 0) {
+			*span = this->m_buffer + command.offset;
+		}
+		else if (command.offset != next) {
+			// Wrapped around to the front of the ring
+			break;
+		}
+		*length += command.length;
+		next = command.offset + command.length;
+		commands++;
+	}
+	return commands;
+}
+
+void CCommandRing::MarkSent(int commands) {
+	if (commands > GetUnsent()) {
+		commands = GetUnsent();
+	}
+	this->m_sent += commands;
+}
+
+void CCommandRing::MarkDone(int commands) {
+	if (commands > GetInFlight()) {
+		commands = GetInFlight();
+	}
+	this->m_done += commands;
+}
+
+void CCommandRing::Clear() {
+	this->m_write = 0;
+	this->m_queued = 0;
+	this->m_sent = 0;
+	this->m_done = 0;
+}
+
+const char * CCommandRing::GetOldestInFlight(int * length, unsigned long * number) const {
+	if (this->m_sent == this->m_done) {
+		*length = 0;
+		*number = 0;
+		return NULL;
+	}
+	const Command & command = this->m_commands[this->m_done % COMMAND_RING_MAX_COMMANDS];
+	*length = command.length - COMMAND_TERMINATOR_LENGTH;
+	*number = this->m_done + 1;
+	return this->m_buffer + command.offset;
+}
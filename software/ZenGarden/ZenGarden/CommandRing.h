@@ -0,0 +1,67 @@
+// CommandRing.h
+//
+// Commands are formatted once, terminator included, straight into a fixed
+// ring of bytes. They stay there while they are waiting to be sent and while
+// the plotter is executing them, and are sent from the ring as contiguous
+// spans, so several commands can go out in one write without being copied.
+//
+//   | done | in flight (sent, waiting for ">") | unsent | free |
+
+#ifndef __COMMAND_RING_H__
+#define __COMMAND_RING_H__
+
+#define COMMAND_RING_SIZE			(16 * 1024)
+#define COMMAND_MAX_LENGTH			128		// Longest formatted command, terminator included
+#define COMMAND_RING_MAX_COMMANDS	1024	// Must be a power of two
+#define COMMAND_TERMINATOR			";\n"
+#define COMMAND_TERMINATOR_LENGTH	2
+
+class CCommandRing
+{
+	public:
+		CCommandRing();
+
+		// Formats a command and its terminator into the ring. Fails when the
+		// ring is full, send and complete some commands first.
+		bool Format(const char * format, ...);
+
+		// True when there is room for one more command of any length
+		bool HasRoom() const { return FindRoom() >= 0; }
+
+		// The longest run of unsent commands that sits in one piece in the
+		// ring, at most maxCommands long. Returns the number of commands.
+		int GetUnsentSpan(int maxCommands, const char ** span, int * length) const;
+		void MarkSent(int commands);
+
+		// The plotter finished the oldest commands in flight
+		void MarkDone(int commands);
+
+		// Forget everything that was not done, sent or not
+		void Clear();
+
+		int GetUnsent() const { return (int)(this->m_queued - this->m_sent); }
+		int GetInFlight() const { return (int)(this->m_sent - this->m_done); }
+
+		// Oldest command in flight, without its terminator. NULL when nothing is in flight.
+		const char * GetOldestInFlight(int * length, unsigned long * number) const;
+
+	private:
+		struct Command {
+			int offset;
+			int length;
+		};
+
+		// Where the next command can go, -1 when the ring is full
+		int FindRoom() const;
+
+		char m_buffer[COMMAND_RING_SIZE];
+		Command m_commands[COMMAND_RING_MAX_COMMANDS];
+		int m_write;			// Where the next command is formatted
+
+		// Commands ever queued, sent and done. Their slot is the count modulo COMMAND_RING_MAX_COMMANDS.
+		unsigned long m_queued;
+		unsigned long m_sent;
+		unsigned long m_done;
+};
+
+#endif
@@ -0,0 +1,356 @@
+// Coverage.cpp
+
+#include "stdafx.h"
+#include "Coverage.h"
+#include <math.h>
+#include <string.h>
+
+// Points closer than this are the same point
+#define COVERAGE_SAME_POINT				0.001f
+
+CCoverageIndex::CCoverageIndex() {
+	this->m_columns = 0;
+	this->m_rows = 0;
+	this->m_minX = 0;
+	this->m_minY = 0;
+	this->m_cellSize = 1;
+	this->m_radius = 0;
+	this->m_sweeps = 0;
+}
+
+CCoverageIndex::CCoverageIndex(float minX, float minY, float maxX, float maxY, float grooveWidth) {
+	Reset(minX, minY, maxX, maxY, grooveWidth);
+}
+
+void CCoverageIndex::Reset(float minX, float minY, float maxX, float maxY, float grooveWidth) {
+	this->m_minX = minX;
+	this->m_minY = minY;
+	this->m_radius = grooveWidth / 2;
+	this->m_cellSize = grooveWidth / COVERAGE_CELLS_PER_GROOVE;
+
+	double width = (maxX > minX) ? maxX - minX : 0;
+	double height = (maxY > minY) ? maxY - minY : 0;
+	while ((width / this->m_cellSize + 1) * (height / this->m_cellSize + 1) > COVERAGE_MAX_CELLS) {
+		this->m_cellSize *= 2;
+	}
+	this->m_columns = (int)(width / this->m_cellSize) + 1;
+	this->m_rows = (int)(height / this->m_cellSize) + 1;
+	this->m_passes.assign((size_t)this->m_columns * this->m_rows, 0);
+	this->m_lastSweeps.assign((size_t)this->m_columns * this->m_rows, 0);
+	this->m_sweeps = 0;
+}
+
+int CCoverageIndex::Sweep(float x0, float y0, float x1, float y1, int * alreadySwept) {
+	return Rasterize(x0, y0, x1, y1, this->m_radius, true, alreadySwept);
+}
+
+bool CCoverageIndex::IsSwept(float x0, float y0, float x1, float y1) {
+	// Only look at the middle of the groove. Cells on the edge flip in and out
+	// with rounding and would stop an exact retrace from counting.
+	int alreadySwept = 0;
+	int cells = Rasterize(x0, y0, x1, y1, this->m_radius - this->m_cellSize / 2, false, &alreadySwept);
+	return (cells > 0 && alreadySwept == cells);
+}
+
+void CCoverageIndex::Clear() {
+	if (!this->m_passes.empty()) {
+		memset(&this->m_passes[0], 0, this->m_passes.size());
+		memset(&this->m_lastSweeps[0], 0, this->m_lastSweeps.size() * sizeof(unsigned int));
+	}
+	this->m_sweeps = 0;
+}
+
+// The cells within radius of a line form a capsule. The capsule is convex so
+// each row of cells crosses it in a single run, found from the two end discs
+// and the rectangle between them.
+//
+// A cell under the ball at the start of the line that the previous sweep also
+// went over is the same pass carrying on. Marking leaves those out of the
+// counts, they were counted by the previous sweep. Checking counts them as
+// swept when an earlier pass went over them too, so a fine retrace of an old
+// groove is still found.
+int CCoverageIndex::Rasterize(float x0, float y0, float x1, float y1, float radius, bool mark, int * alreadySwept) {
+	*alreadySwept = 0;
+	if (radius <= 0) {
+		return 0;
+	}
+	unsigned int previousSweep = this->m_sweeps;
+	unsigned int sweep = previousSweep;
+	if (mark) {
+		sweep = ++this->m_sweeps;
+	}
+	double ballRadius2 = (double)this->m_radius * this->m_radius;
+
+	double dx = (double)x1 - x0;
+	double dy = (double)y1 - y0;
+	double length2 = dx * dx + dy * dy;
+	double length = sqrt(length2);
+	double radius2 = (double)radius * radius;
+
+	double top = ((y0 < y1) ? y0 : y1) - radius;
+	double bottom = ((y0 > y1) ? y0 : y1) + radius;
+	int firstRow = (int)ceil((top - this->m_minY) / this->m_cellSize - 0.5);
+	int lastRow = (int)floor((bottom - this->m_minY) / this->m_cellSize - 0.5);
+	if (firstRow < 0) {
+		firstRow = 0;
+	}
+	if (lastRow >= this->m_rows) {
+		lastRow = this->m_rows - 1;
+	}
+
+	int cells = 0;
+	for (int row = firstRow; row <= lastRow; row++) {
+		double y = this->m_minY + (row + 0.5) * this->m_cellSize;
+		double left = HUGE_VAL;
+		double right = -HUGE_VAL;
+
+		// End discs
+		double offset0 = y - y0;
+		if (offset0 * offset0 <= radius2) {
+			double half = sqrt(radius2 - offset0 * offset0);
+			left = x0 - half;
+			right = x0 + half;
+		}
+		double offset1 = y - y1;
+		if (offset1 * offset1 <= radius2) {
+			double half = sqrt(radius2 - offset1 * offset1);
+			if (x1 - half < left) {
+				left = x1 - half;
+			}
+			if (x1 + half > right) {
+				right = x1 + half;
+			}
+		}
+
+		// Rectangle, solved for u = x - x0. Along the line 0 <= u*dx + offset0*dy <= length2
+		// and across it |u*dy - offset0*dx| <= radius*length.
+		if (length2 > 0) {
+			double low = -HUGE_VAL;
+			double high = HUGE_VAL;
+			double along0 = -offset0 * dy;
+			double along1 = length2 - offset0 * dy;
+			if (dx != 0) {
+				double a = along0 / dx;
+				double b = along1 / dx;
+				low = (a < b) ? a : b;
+				high = (a < b) ? b : a;
+			}
+			else if (along0 > 0 || along1 < 0) {
+				high = -HUGE_VAL;
+			}
+			double across0 = offset0 * dx - radius * length;
+			double across1 = offset0 * dx + radius * length;
+			if (dy != 0) {
+				double a = across0 / dy;
+				double b = across1 / dy;
+				if (((a < b) ? a : b) > low) {
+					low = (a < b) ? a : b;
+				}
+				if (((a < b) ? b : a) < high) {
+					high = (a < b) ? b : a;
+				}
+			}
+			else if (across0 > 0 || across1 < 0) {
+				high = -HUGE_VAL;
+			}
+			if (low <= high) {
+				if (x0 + low < left) {
+					left = x0 + low;
+				}
+				if (x0 + high > right) {
+					right = x0 + high;
+				}
+			}
+		}
+
+		if (left > right) {
+			continue;
+		}
+		int firstColumn = (int)ceil((left - this->m_minX) / this->m_cellSize - 0.5);
+		int lastColumn = (int)floor((right - this->m_minX) / this->m_cellSize - 0.5);
+		if (firstColumn < 0) {
+			firstColumn = 0;
+		}
+		if (lastColumn >= this->m_columns) {
+			lastColumn = this->m_columns - 1;
+		}
+		if (firstColumn > lastColumn) {
+			continue;
+		}
+
+		size_t first = (size_t)row * this->m_columns + firstColumn;
+		unsigned char * passes = &this->m_passes[first];
+		unsigned int * lastSweep = &this->m_lastSweeps[first];
+		double startOffset = this->m_minX + (firstColumn + 0.5) * this->m_cellSize - x0;
+		for (int column = firstColumn; column <= lastColumn; column++, passes++, lastSweep++, startOffset += this->m_cellSize) {
+			bool carriesOn = (*lastSweep != 0 && *lastSweep == previousSweep && startOffset * startOffset + offset0 * offset0 <= ballRadius2);
+			if (!carriesOn) {
+				cells++;
+				*alreadySwept += (*passes > 0) ? 1 : 0;
+				if (mark && *passes < 2) {
+					(*passes)++;
+				}
+			}
+			else if (!mark && *passes >= 2) {
+				cells++;
+				(*alreadySwept)++;
+			}
+			if (mark) {
+				*lastSweep = sweep;
+			}
+		}
+	}
+	return cells;
+}
+
+static bool IsSegmentSwept(CCoverageIndex & index, const ToolpathPoint & start, const std::vector<ToolpathPoint> & points) {
+	ToolpathPoint from = start;
+	for (size_t point = 0; point < points.size(); point++) {
+		if (!index.IsSwept(from.x, from.y, points[point].x, points[point].y)) {
+			return false;
+		}
+		from = points[point];
+	}
+	return true;
+}
+
+static void SweepSegment(CCoverageIndex & index, const ToolpathPoint & start, const std::vector<ToolpathPoint> & points, long long * swept, long long * alreadySwept) {
+	ToolpathPoint from = start;
+	for (size_t point = 0; point < points.size(); point++) {
+		int already = 0;
+		*swept += index.Sweep(from.x, from.y, points[point].x, points[point].y, &already);
+		*alreadySwept += already;
+		from = points[point];
+	}
+}
+
+void CCoverageAnalyzer::Analyze(const CToolpath & path, float grooveWidth, CoverageReport * report, CToolpath * culled) {
+	memset(report, 0, sizeof(CoverageReport));
+	report->segments = path.segments.size();
+	report->length = path.Length();
+	if (culled != NULL) {
+		culled->Clear();
+	}
+	if (path.segments.empty()) {
+		return;
+	}
+
+	// Bounds of everything the path can reach, arcs as their whole circle
+	float minX = path.segments[0].x;
+	float maxX = minX;
+	float minY = path.segments[0].y;
+	float maxY = minY;
+	for (size_t index = 0; index < path.segments.size(); index++) {
+		const ToolpathSegment & segment = path.segments[index];
+		float reach = 0;
+		float centreX = segment.x;
+		float centreY = segment.y;
+		if (segment.type == TOOLPATH_ARC_CW || segment.type == TOOLPATH_ARC_CCW) {
+			ToolpathPoint start = path.GetStart(index);
+			centreX = start.x + segment.i;
+			centreY = start.y + segment.j;
+			reach = sqrtf(segment.i * segment.i + segment.j * segment.j);
+		}
+		minX = (centreX - reach < minX) ? centreX - reach : minX;
+		maxX = (centreX + reach > maxX) ? centreX + reach : maxX;
+		minY = (centreY - reach < minY) ? centreY - reach : minY;
+		maxY = (centreY + reach > maxY) ? centreY + reach : maxY;
+	}
+	minX -= grooveWidth;
+	minY -= grooveWidth;
+	maxX += grooveWidth;
+	maxY += grooveWidth;
+
+	float maxChord = grooveWidth / 2;
+	CCoverageIndex & original = this->m_original;
+	original.Reset(minX, minY, maxX, maxY, grooveWidth);
+	long long swept = 0;
+	long long alreadySwept = 0;
+
+	// What the culled path has drawn so far, and the run of redundant segments being held back
+	CCoverageIndex * output = NULL;
+	if (culled != NULL) {
+		output = &this->m_output;
+		output->Reset(minX, minY, maxX, maxY, grooveWidth);
+	}
+	long long outputSwept = 0;
+	long long outputAlreadySwept = 0;
+	bool inRun = false;
+	size_t runFirst = 0;
+	ToolpathPoint runStart = { 0, 0 };
+
+	std::vector<ToolpathPoint> & points = this->m_points;
+	for (size_t index = 0; index <= path.segments.size(); index++) {
+		bool last = (index == path.segments.size());
+		ToolpathPoint start = path.GetStart(index);
+
+		points.clear();
+		bool outputRedundant = false;
+		if (!last) {
+			const ToolpathSegment & segment = path.segments[index];
+			FlattenSegment(start.x, start.y, segment, maxChord, points);
+
+			if (IsSegmentSwept(original, start, points)) {
+				report->redundantSegments++;
+			}
+			SweepSegment(original, start, points, &swept, &alreadySwept);
+
+			if (output == NULL) {
+				continue;
+			}
+			outputRedundant = IsSegmentSwept(*output, start, points);
+			if (outputRedundant) {
+				if (!inRun) {
+					inRun = true;
+					runFirst = index;
+					runStart = start;
+				}
+				continue;
+			}
+		}
+
+		if (inRun) {
+			// start is where the run ended
+			size_t runLength = index - runFirst;
+			bool hasMove = false;
+			for (size_t run = runFirst; run < index; run++) {
+				hasMove = hasMove || (path.segments[run].type == TOOLPATH_MOVE);
+			}
+			bool returns = (fabsf(start.x - runStart.x) < COVERAGE_SAME_POINT && fabsf(start.y - runStart.y) < COVERAGE_SAME_POINT);
+			if (last || returns) {
+				report->culledSegments += runLength;
+			}
+			else if (output->IsSwept(runStart.x, runStart.y, start.x, start.y)) {
+				if (hasMove) {
+					culled->MoveTo(start.x, start.y);
+				}
+				else {
+					culled->LineTo(start.x, start.y);
+				}
+				report->culledSegments += runLength - 1;
+			}
+			else {
+				// The shortcut would cut new sand, keep the run as it was
+				std::vector<ToolpathPoint> & runPoints = this->m_runPoints;
+				for (size_t run = runFirst; run < index; run++) {
+					ToolpathPoint runSegmentStart = path.GetStart(run);
+					runPoints.clear();
+					FlattenSegment(runSegmentStart.x, runSegmentStart.y, path.segments[run], maxChord, runPoints);
+					SweepSegment(*output, runSegmentStart, runPoints, &outputSwept, &outputAlreadySwept);
+					culled->segments.push_back(path.segments[run]);
+				}
+			}
+			inRun = false;
+		}
+
+		if (!last) {
+			SweepSegment(*output, start, points, &outputSwept, &outputAlreadySwept);
+			culled->segments.push_back(path.segments[index]);
+		}
+	}
+
+	report->overdrawPercent = (swept > 0) ? (alreadySwept * 100.0) / swept : 0;
+	if (output != NULL) {
+		report->culledLength = culled->Length();
+	}
+}
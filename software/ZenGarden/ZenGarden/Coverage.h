@@ -0,0 +1,90 @@
+// Coverage.h
+//
+// Keeps track of the sand the ball has already swept. The table is split in
+// a uniform grid of cells a quarter of the groove width wide. A segment sweeps
+// every cell whose centre is within half a groove width of it.
+//
+// A cell only counts as swept once the ball has left it and come back. The
+// cells under the ball where a segment starts were swept by the segment just
+// before it, so a finely sampled curve does not count as retracing itself.
+//
+// Used to measure how much of a pattern redraws grooves that already exist,
+// and optionally to drop or shorten the segments that only do that.
+
+#ifndef __COVERAGE_H__
+#define __COVERAGE_H__
+
+#include <vector>
+#include "Toolpath.h"
+
+// Cells per groove width
+#define COVERAGE_CELLS_PER_GROOVE		4
+
+// Upper limit on the grid size, the cells get bigger on very large paths
+#define COVERAGE_MAX_CELLS				(16 * 1024 * 1024)
+
+class CCoverageIndex
+{
+	public:
+		CCoverageIndex();
+		CCoverageIndex(float minX, float minY, float maxX, float maxY, float grooveWidth);
+
+		// Empties the index and sizes it for a new area. The cells are only
+		// reallocated when the new area needs more of them.
+		void Reset(float minX, float minY, float maxX, float maxY, float grooveWidth);
+
+		// Marks the cells swept by a line. Returns the number of cells it swept,
+		// alreadySwept is set to how many of them were swept before.
+		int Sweep(float x0, float y0, float x1, float y1, int * alreadySwept);
+
+		// True if the centre of the groove a line would make is already swept,
+		// so drawing it changes nothing. Nothing is marked.
+		bool IsSwept(float x0, float y0, float x1, float y1);
+
+		void Clear();
+
+	private:
+		// Visits the cells with their centre within radius of the line
+		int Rasterize(float x0, float y0, float x1, float y1, float radius, bool mark, int * alreadySwept);
+
+		std::vector<unsigned char> m_passes;		// Separate times the ball went over each cell, up to 2
+		std::vector<unsigned int> m_lastSweeps;	// Sweep that last went over each cell, 0 for none
+		unsigned int m_sweeps;
+		int m_columns;
+		int m_rows;
+		float m_minX;
+		float m_minY;
+		float m_cellSize;
+		float m_radius;
+};
+
+struct CoverageReport
+{
+	size_t segments;
+	size_t redundantSegments;	// Segments that only retrace existing grooves
+	double overdrawPercent;		// Share of the swept cells that were already swept
+	float length;
+
+	// Filled in when culling
+	size_t culledSegments;
+	float culledLength;
+};
+
+class CCoverageAnalyzer
+{
+	public:
+		// Measures the overdraw of a path. When culled is not NULL it also receives a
+		// copy of the path without the redundant segments. A run of redundant segments
+		// is replaced by a straight line when that line is itself redundant, and
+		// dropped when it returns to where it started or ends the path.
+		void Analyze(const CToolpath & path, float grooveWidth, CoverageReport * report, CToolpath * culled);
+
+	private:
+		// Kept between calls so analysing another pattern reuses their storage
+		CCoverageIndex m_original;
+		CCoverageIndex m_output;
+		std::vector<ToolpathPoint> m_points;
+		std::vector<ToolpathPoint> m_runPoints;
+};
+
+#endif
@@ -0,0 +1,42 @@
+// HeapCounter.cpp
+
+#include "stdafx.h"
+#include "HeapCounter.h"
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+static std::atomic<unsigned long long> heapAllocations(0);
+
+unsigned long long GetHeapAllocations() {
+	return heapAllocations.load();
+}
+
+void * operator new(size_t size) {
+	heapAllocations++;
+	void * memory = malloc(size ? size : 1);
+	if (memory == NULL) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void * operator new[](size_t size) {
+	return operator new(size);
+}
+
+void operator delete(void * memory) noexcept {
+	free(memory);
+}
+
+void operator delete[](void * memory) noexcept {
+	free(memory);
+}
+
+void operator delete(void * memory, size_t) noexcept {
+	free(memory);
+}
+
+void operator delete[](void * memory, size_t) noexcept {
+	free(memory);
+}
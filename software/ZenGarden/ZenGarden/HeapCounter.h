@@ -0,0 +1,13 @@
+// HeapCounter.h
+//
+// Counts every allocation made with new. The global operator new and delete
+// are replaced in HeapCounter.cpp, the count proves that drawing a pattern the
+// second time around does not touch the heap.
+
+#ifndef __HEAP_COUNTER_H__
+#define __HEAP_COUNTER_H__
+
+// Allocations made since the program started
+unsigned long long GetHeapAllocations();
+
+#endif
@@ -0,0 +1,69 @@
+// Keyboard.cpp
+
+#include "stdafx.h"
+#include "Keyboard.h"
+#include "Timing.h"
+#include <conio.h>
+
+// How often the thread looks for a key
+#define KEYBOARD_POLL_MS				1
+
+CKeyboard::CKeyboard() {
+	this->m_running = false;
+	this->m_listener = NULL;
+	this->m_first = 0;
+	this->m_count = 0;
+}
+
+CKeyboard::~CKeyboard() {
+	Stop();
+}
+
+void CKeyboard::Start(CKeyListener * listener) {
+	if (this->m_running) {
+		return;
+	}
+	this->m_listener = listener;
+	this->m_running = true;
+	this->m_thread = std::thread(&CKeyboard::Poll, this);
+}
+
+void CKeyboard::Stop() {
+	this->m_running = false;
+	if (this->m_thread.joinable()) {
+		this->m_thread.join();
+	}
+}
+
+bool CKeyboard::GetKey(char * key, int * action) {
+	std::unique_lock<std::mutex> lock(this->m_mutex);
+	if (this->m_count == 0) {
+		return false;
+	}
+	*key = this->m_keys[this->m_first];
+	*action = this->m_actions[this->m_first];
+	this->m_first = (this->m_first + 1) % KEYBOARD_MAX_KEYS;
+	this->m_count--;
+	return true;
+}
+
+void CKeyboard::Poll() {
+	while (this->m_running) {
+		if (!_kbhit()) {
+			Sleep(KEYBOARD_POLL_MS);
+			continue;
+		}
+		LONGLONG pressedAt = GetTimeMicroseconds();
+		char key = _getch();
+		int action = this->m_listener->KeyPressed(key, pressedAt);
+
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+		if (this->m_count == KEYBOARD_MAX_KEYS) {
+			continue;
+		}
+		int last = (this->m_first + this->m_count) % KEYBOARD_MAX_KEYS;
+		this->m_keys[last] = key;
+		this->m_actions[last] = action;
+		this->m_count++;
+	}
+}
@@ -0,0 +1,54 @@
+// Keyboard.h
+//
+// Reads the keyboard on its own thread. The main thread can be busy sending,
+// sleeping or building a pattern for a long time, so each key goes to a
+// listener on the keyboard thread the moment it is pressed. The key and what
+// the listener did with it are then queued for the main thread.
+
+#ifndef __KEYBOARD_H__
+#define __KEYBOARD_H__
+
+#include <windows.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+// Keys pressed faster than the main thread reads them, the rest are dropped
+#define KEYBOARD_MAX_KEYS				16
+
+class CKeyListener
+{
+	public:
+		virtual ~CKeyListener() {}
+
+		// Called on the keyboard thread. The result is queued with the key.
+		virtual int KeyPressed(char key, LONGLONG pressedAt) = 0;
+};
+
+class CKeyboard
+{
+	public:
+		CKeyboard();
+		~CKeyboard();
+
+		void Start(CKeyListener * listener);
+		void Stop();
+
+		// The oldest key not read yet and what the listener returned for it,
+		// false if there is none
+		bool GetKey(char * key, int * action);
+
+	private:
+		void Poll();
+
+		std::thread m_thread;
+		std::atomic<bool> m_running;
+		CKeyListener * m_listener;
+		std::mutex m_mutex;
+		char m_keys[KEYBOARD_MAX_KEYS];
+		int m_actions[KEYBOARD_MAX_KEYS];
+		int m_first;
+		int m_count;
+};
+
+#endif
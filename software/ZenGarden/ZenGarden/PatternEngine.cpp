@@ -0,0 +1,404 @@
+// PatternEngine.cpp
+
+#include "stdafx.h"
+#include "PatternEngine.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GENERATIVE_PI					3.14159265358979323846
+
+// Default distance between points
+#define GENERATIVE_RESOLUTION			1.0f
+
+// ----------------------------------------------------------------------------
+// Random numbers and noise. Everything is a pure function of its inputs so
+// any thread can evaluate any point and get the same answer.
+// ----------------------------------------------------------------------------
+
+static unsigned int NextRandom(unsigned int * state) {
+	unsigned int z = (*state += 0x9E3779B9);
+	z = (z ^ (z >> 16)) * 0x85EBCA6B;
+	z = (z ^ (z >> 13)) * 0xC2B2AE35;
+	return z ^ (z >> 16);
+}
+
+// Inclusive of both ends
+static int RandomRange(unsigned int * state, int low, int high) {
+	return low + (int)(NextRandom(state) % (unsigned int)(high - low + 1));
+}
+
+static float RandomFloat(unsigned int * state) {
+	return (NextRandom(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+static unsigned int Hash(int x, int y, unsigned int seed) {
+	unsigned int state = seed ^ ((unsigned int)x * 0x27D4EB2D) ^ ((unsigned int)y * 0x165667B1);
+	return NextRandom(&state);
+}
+
+static float Fade(float t) {
+	return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+static float Gradient(int x, int y, unsigned int seed, float dx, float dy) {
+	float angle = (Hash(x, y, seed) & 0xFFFF) * (float)(2 * GENERATIVE_PI / 65536);
+	return cosf(angle) * dx + sinf(angle) * dy;
+}
+
+// Gradient (Perlin) noise, roughly -1 to 1
+static float GradientNoise(float x, float y, unsigned int seed) {
+	int x0 = (int)floorf(x);
+	int y0 = (int)floorf(y);
+	float fx = x - x0;
+	float fy = y - y0;
+	float n00 = Gradient(x0, y0, seed, fx, fy);
+	float n10 = Gradient(x0 + 1, y0, seed, fx - 1, fy);
+	float n01 = Gradient(x0, y0 + 1, seed, fx, fy - 1);
+	float n11 = Gradient(x0 + 1, y0 + 1, seed, fx - 1, fy - 1);
+	float u = Fade(fx);
+	float v = Fade(fy);
+	float bottom = n00 + (n10 - n00) * u;
+	float top = n01 + (n11 - n01) * u;
+	return (bottom + (top - bottom) * v) * 1.4142f;
+}
+
+static int GreatestCommonDivisor(int a, int b) {
+	a = abs(a);
+	b = abs(b);
+	while (b != 0) {
+		int remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return (a != 0) ? a : 1;
+}
+
+// ----------------------------------------------------------------------------
+// Closed curves
+// ----------------------------------------------------------------------------
+
+struct CurveSampling
+{
+	double period;		// Parameter range of one full loop
+	double scale;		// Curve units to table units
+	size_t segments;	// The curve has segments + 1 points
+};
+
+// Works out how far the parameter runs before the curve closes and how finely
+// it has to be sampled so no two points are more than resolution apart.
+static bool PlanCurve(const GenerativeDesign & design, CurveSampling * sampling) {
+	double extent;
+	double speed;		// Fastest the curve moves per unit of parameter
+	switch (design.family) {
+		case GENERATIVE_HYPOTROCHOID: {
+			int fixedRadius = design.hypotrochoid.fixedRadius;
+			int rollingRadius = design.hypotrochoid.rollingRadius;
+			if (fixedRadius <= 0 || rollingRadius <= 0 || fixedRadius == rollingRadius) {
+				return false;
+			}
+			double difference = fabs((double)fixedRadius - rollingRadius);
+			double pen = fabs(design.hypotrochoid.penDistance);
+			sampling->period = 2 * GENERATIVE_PI * rollingRadius / GreatestCommonDivisor(fixedRadius, rollingRadius);
+			extent = difference + pen;
+			speed = difference + pen * difference / rollingRadius;
+			break;
+		}
+		case GENERATIVE_LISSAJOUS: {
+			int frequencyX = design.lissajous.frequencyX;
+			int frequencyY = design.lissajous.frequencyY;
+			if (frequencyX <= 0 || frequencyY <= 0) {
+				return false;
+			}
+			sampling->period = 2 * GENERATIVE_PI / GreatestCommonDivisor(frequencyX, frequencyY);
+			extent = sqrt(2.0);
+			speed = sqrt((double)frequencyX * frequencyX + (double)frequencyY * frequencyY);
+			break;
+		}
+		case GENERATIVE_ROSE: {
+			if (design.rose.numerator <= 0 || design.rose.denominator <= 0) {
+				return false;
+			}
+			int divisor = GreatestCommonDivisor(design.rose.numerator, design.rose.denominator);
+			int numerator = design.rose.numerator / divisor;
+			int denominator = design.rose.denominator / divisor;
+			double petals = (double)numerator / denominator;
+			sampling->period = ((numerator * denominator) % 2 == 1) ? GENERATIVE_PI * denominator : 2 * GENERATIVE_PI * denominator;
+			extent = 1;
+			speed = sqrt(1 + petals * petals);
+			break;
+		}
+		default: {
+			return false;
+		}
+	}
+
+	float resolution = (design.resolution > 0) ? design.resolution : GENERATIVE_RESOLUTION;
+	sampling->scale = design.radius / extent;
+	double segments = ceil(sampling->period * speed * sampling->scale / resolution);
+	if (segments < 16) {
+		segments = 16;
+	}
+	if (segments > GENERATIVE_MAX_POINTS - 1) {
+		segments = GENERATIVE_MAX_POINTS - 1;
+	}
+	sampling->segments = (size_t)segments;
+	return true;
+}
+
+static ToolpathPoint CurvePoint(const GenerativeDesign & design, double t, double scale) {
+	double x = 0;
+	double y = 0;
+	switch (design.family) {
+		case GENERATIVE_HYPOTROCHOID: {
+			double difference = (double)design.hypotrochoid.fixedRadius - design.hypotrochoid.rollingRadius;
+			double turn = difference / design.hypotrochoid.rollingRadius * t;
+			x = difference * cos(t) + design.hypotrochoid.penDistance * cos(turn);
+			y = difference * sin(t) - design.hypotrochoid.penDistance * sin(turn);
+			break;
+		}
+		case GENERATIVE_LISSAJOUS: {
+			x = sin(design.lissajous.frequencyX * t + design.lissajous.phase);
+			y = sin(design.lissajous.frequencyY * t);
+			break;
+		}
+		case GENERATIVE_ROSE: {
+			double distance = cos((double)design.rose.numerator / design.rose.denominator * t);
+			x = distance * cos(t);
+			y = distance * sin(t);
+			break;
+		}
+	}
+	ToolpathPoint point = { (float)(x * scale), (float)(y * scale) };
+	return point;
+}
+
+// One chunk of GENERATIVE_CHUNK_POINTS points per index. Point i is always
+// evaluated at the same parameter, however the curve is split.
+class CCurveJob : public CParallelJob
+{
+	public:
+		CCurveJob(const GenerativeDesign & design, const CurveSampling & sampling, ToolpathPoint * points) :
+			m_design(design), m_sampling(sampling), m_points(points) {
+		}
+
+		size_t GetChunks() const {
+			return (this->m_sampling.segments + GENERATIVE_CHUNK_POINTS) / GENERATIVE_CHUNK_POINTS;
+		}
+
+		void Run(size_t chunk) {
+			size_t first = chunk * GENERATIVE_CHUNK_POINTS;
+			size_t last = first + GENERATIVE_CHUNK_POINTS;
+			if (last > this->m_sampling.segments + 1) {
+				last = this->m_sampling.segments + 1;
+			}
+			for (size_t index = first; index < last; index++) {
+				double t = this->m_sampling.period * index / this->m_sampling.segments;
+				this->m_points[index] = CurvePoint(this->m_design, t, this->m_sampling.scale);
+			}
+		}
+
+	private:
+		const GenerativeDesign & m_design;
+		const CurveSampling & m_sampling;
+		ToolpathPoint * m_points;
+};
+
+// ----------------------------------------------------------------------------
+// Flow fields
+// ----------------------------------------------------------------------------
+
+// One streamline per index. Each one has its own slot of steps + 1 points and
+// its own random start, derived from the seed and the line number.
+class CFlowFieldJob : public CParallelJob
+{
+	public:
+		CFlowFieldJob(const GenerativeDesign & design, ToolpathPoint * points, int * lengths) :
+			m_design(design), m_points(points), m_lengths(lengths) {
+		}
+
+		void Run(size_t line) {
+			const GenerativeDesign & design = this->m_design;
+			float radius = design.radius;
+			float resolution = (design.resolution > 0) ? design.resolution : GENERATIVE_RESOLUTION;
+			float noiseScale = design.flowField.noiseScale / radius;
+			ToolpathPoint * points = this->m_points + line * (design.flowField.steps + 1);
+
+			unsigned int state = Hash((int)line, 0, design.flowField.seed);
+			float angle = RandomFloat(&state) * (float)(2 * GENERATIVE_PI);
+			float distance = sqrtf(RandomFloat(&state)) * radius;
+			ToolpathPoint point = { cosf(angle) * distance, sinf(angle) * distance };
+			points[0] = point;
+
+			int length = 1;
+			for (int step = 0; step < design.flowField.steps; step++) {
+				float heading = GradientNoise(point.x * noiseScale, point.y * noiseScale, design.flowField.seed) * (float)GENERATIVE_PI;
+				point.x += cosf(heading) * resolution;
+				point.y += sinf(heading) * resolution;
+				if (point.x * point.x + point.y * point.y > radius * radius) {
+					break;
+				}
+				points[length++] = point;
+			}
+			this->m_lengths[line] = length;
+		}
+
+	private:
+		const GenerativeDesign & m_design;
+		ToolpathPoint * m_points;
+		int * m_lengths;
+};
+
+// ----------------------------------------------------------------------------
+
+// Builds a design on the pool, or on the calling thread when pool is NULL
+static void GenerateDesign(const GenerativeDesign & design, CToolpath & path, std::vector<ToolpathPoint> & points, std::vector<int> & lineLengths, CThreadPool * pool) {
+	path.Clear();
+
+	if (design.family == GENERATIVE_FLOW_FIELD) {
+		int lines = design.flowField.lines;
+		int steps = design.flowField.steps;
+		if (lines <= 0 || steps <= 0 || design.radius <= 0) {
+			return;
+		}
+		if ((size_t)lines * (steps + 1) > GENERATIVE_MAX_POINTS) {
+			lines = GENERATIVE_MAX_POINTS / (steps + 1);
+		}
+		points.resize((size_t)lines * (steps + 1));
+		lineLengths.resize(lines);
+
+		CFlowFieldJob job(design, &points[0], &lineLengths[0]);
+		if (pool != NULL) {
+			pool->Run(job, lines);
+		}
+		else {
+			for (int line = 0; line < lines; line++) {
+				job.Run(line);
+			}
+		}
+
+		// Stitch the streamlines together in order, one stroke each
+		for (int line = 0; line < lines; line++) {
+			if (lineLengths[line] < 2) {
+				continue;
+			}
+			const ToolpathPoint * linePoints = &points[(size_t)line * (steps + 1)];
+			path.MoveTo(linePoints[0].x, linePoints[0].y);
+			for (int point = 1; point < lineLengths[line]; point++) {
+				path.LineTo(linePoints[point].x, linePoints[point].y);
+			}
+		}
+		return;
+	}
+
+	CurveSampling sampling;
+	if (!PlanCurve(design, &sampling)) {
+		printf("Error: Invalid generative design. family=%d\n", design.family);
+		return;
+	}
+	points.resize(sampling.segments + 1);
+
+	CCurveJob job(design, sampling, &points[0]);
+	if (pool != NULL) {
+		pool->Run(job, job.GetChunks());
+	}
+	else {
+		for (size_t chunk = 0; chunk < job.GetChunks(); chunk++) {
+			job.Run(chunk);
+		}
+	}
+
+	// The chunks sit next to each other in points, so this is one continuous curve
+	path.segments.reserve(points.size());
+	path.MoveTo(points[0].x, points[0].y);
+	for (size_t point = 1; point < points.size(); point++) {
+		path.LineTo(points[point].x, points[point].y);
+	}
+}
+
+// Each index is a whole design, built on one thread with that thread's own scratch space
+class CBatchJob : public CParallelJob
+{
+	public:
+		CBatchJob(const GenerativeDesign * designs, CToolpath * paths) : m_designs(designs), m_paths(paths) {
+		}
+
+		void Run(size_t index) {
+			static thread_local std::vector<ToolpathPoint> points;
+			static thread_local std::vector<int> lineLengths;
+			GenerateDesign(this->m_designs[index], this->m_paths[index], points, lineLengths, NULL);
+		}
+
+	private:
+		const GenerativeDesign * m_designs;
+		CToolpath * m_paths;
+};
+
+CPatternEngine::CPatternEngine(int threads) : m_pool(threads) {
+}
+
+GenerativeDesign CPatternEngine::DefaultDesign(int family, float radius) {
+	GenerativeDesign design;
+	memset(&design, 0, sizeof(design));
+	design.family = family;
+	design.radius = radius;
+	design.resolution = GENERATIVE_RESOLUTION;
+
+	design.hypotrochoid.fixedRadius = 5;
+	design.hypotrochoid.rollingRadius = 3;
+	design.hypotrochoid.penDistance = 2.5f;
+
+	design.lissajous.frequencyX = 3;
+	design.lissajous.frequencyY = 4;
+	design.lissajous.phase = (float)(GENERATIVE_PI / 2);
+
+	design.rose.numerator = 5;
+	design.rose.denominator = 3;
+
+	design.flowField.seed = 1;
+	design.flowField.lines = 40;
+	design.flowField.steps = 200;
+	design.flowField.noiseScale = 2;
+	return design;
+}
+
+GenerativeDesign CPatternEngine::RandomDesign(unsigned int seed, float radius) {
+	unsigned int state = seed;
+	GenerativeDesign design = DefaultDesign(RandomRange(&state, 0, GENERATIVE_FAMILIES - 1), radius);
+	switch (design.family) {
+		case GENERATIVE_HYPOTROCHOID: {
+			design.hypotrochoid.fixedRadius = RandomRange(&state, 3, 15);
+			design.hypotrochoid.rollingRadius = RandomRange(&state, 1, design.hypotrochoid.fixedRadius - 1);
+			design.hypotrochoid.penDistance = (0.2f + RandomFloat(&state)) * design.hypotrochoid.rollingRadius;
+			break;
+		}
+		case GENERATIVE_LISSAJOUS: {
+			design.lissajous.frequencyX = RandomRange(&state, 1, 9);
+			design.lissajous.frequencyY = RandomRange(&state, 1, 9);
+			design.lissajous.phase = RandomFloat(&state) * (float)GENERATIVE_PI;
+			break;
+		}
+		case GENERATIVE_ROSE: {
+			design.rose.numerator = RandomRange(&state, 1, 9);
+			design.rose.denominator = RandomRange(&state, 1, 9);
+			break;
+		}
+		case GENERATIVE_FLOW_FIELD: {
+			design.flowField.seed = NextRandom(&state);
+			design.flowField.lines = RandomRange(&state, 20, 80);
+			design.flowField.steps = RandomRange(&state, 100, 300);
+			design.flowField.noiseScale = 1 + RandomFloat(&state) * 3;
+			break;
+		}
+	}
+	return design;
+}
+
+void CPatternEngine::Generate(const GenerativeDesign & design, CToolpath & path) {
+	GenerateDesign(design, path, this->m_points, this->m_lineLengths, &this->m_pool);
+}
+
+void CPatternEngine::GenerateBatch(const GenerativeDesign * designs, size_t count, CToolpath * paths) {
+	CBatchJob job(designs, paths);
+	this->m_pool.Run(job, count);
+}
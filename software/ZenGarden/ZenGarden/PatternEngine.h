@@ -0,0 +1,91 @@
+// PatternEngine.h
+//
+// Generative patterns: spirographs (hypotrochoids), Lissajous figures, roses
+// and noise driven flow fields. Every design is centred on (0, 0) and scaled
+// to fit in a circle of the given radius.
+//
+// Long curves are split in chunks that are evaluated in parallel and stitched
+// back together in order. Every point only depends on the design, so the
+// toolpath is the same whatever the number of threads, and the same seed
+// always gives the same design.
+
+#ifndef __PATTERN_ENGINE_H__
+#define __PATTERN_ENGINE_H__
+
+#include <vector>
+#include "Toolpath.h"
+#include "ThreadPool.h"
+
+#define GENERATIVE_HYPOTROCHOID			0
+#define GENERATIVE_LISSAJOUS			1
+#define GENERATIVE_ROSE					2
+#define GENERATIVE_FLOW_FIELD			3
+#define GENERATIVE_FAMILIES				4
+
+// Points evaluated by one job
+#define GENERATIVE_CHUNK_POINTS			4096
+
+// Upper limit on the points of one design
+#define GENERATIVE_MAX_POINTS			(4 * 1024 * 1024)
+
+struct GenerativeDesign
+{
+	int family;
+	float radius;			// The design fits in a circle of this radius
+	float resolution;		// Longest distance between two points
+
+	struct {
+		int fixedRadius;		// Circle that is rolled around
+		int rollingRadius;		// Circle that rolls inside it
+		float penDistance;		// From the centre of the rolling circle
+	} hypotrochoid;
+
+	struct {
+		int frequencyX;
+		int frequencyY;
+		float phase;			// Radians, added to X
+	} lissajous;
+
+	struct {
+		int numerator;			// Petals are numerator / denominator
+		int denominator;
+	} rose;
+
+	struct {
+		unsigned int seed;
+		int lines;				// Number of streamlines
+		int steps;				// Longest streamline, in resolution steps
+		float noiseScale;		// Noise features across the radius
+	} flowField;
+};
+
+class CPatternEngine
+{
+	public:
+		// threads is the total number of threads, 0 uses every core
+		CPatternEngine(int threads = 0);
+
+		// A design of the family with reasonable defaults
+		static GenerativeDesign DefaultDesign(int family, float radius);
+
+		// A random design of any family. The same seed always gives the same design.
+		static GenerativeDesign RandomDesign(unsigned int seed, float radius);
+
+		// Builds one design, long curves are evaluated on every thread
+		void Generate(const GenerativeDesign & design, CToolpath & path);
+
+		// Builds many designs at once, each one on a single thread. For
+		// generating lots of candidate designs.
+		void GenerateBatch(const GenerativeDesign * designs, size_t count, CToolpath * paths);
+
+		int GetThreads() const { return this->m_pool.GetThreads(); }
+
+	private:
+		CThreadPool m_pool;
+
+		// Kept between calls so generating another design reuses their storage
+		std::vector<ToolpathPoint> m_points;
+		std::vector<int> m_lineLengths;
+};
+
+#endif
@@ -0,0 +1,290 @@
+// Placement.cpp
+
+#include "stdafx.h"
+#include "Placement.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#define PLACEMENT_PI					3.14159265358979323846
+
+// Pieces of an arc shorter than this share of the arc are rounding, not worth drawing
+#define CLIP_MIN_ARC_FRACTION			1e-6
+
+void PlaceToolpath(CToolpath & path, const Placement & placement) {
+	double angle = placement.rotation * PLACEMENT_PI / 180;
+	float xx = (float)(cos(angle) * placement.scale);
+	float xy = (float)(-sin(angle) * placement.scale);
+	float yx = (float)(sin(angle) * placement.scale);
+	float yy = (float)(cos(angle) * placement.scale);
+	float originX = placement.originX;
+	float originY = placement.originY;
+
+	// Straight through the segments, nothing depends on the segment before.
+	// The arc centre offsets turn and scale but do not move, they are 0 for lines.
+	size_t count = path.segments.size();
+	ToolpathSegment * segment = count > 0 ? &path.segments[0] : NULL;
+	for (size_t index = 0; index < count; index++, segment++) {
+		float x = segment->x;
+		float y = segment->y;
+		float i = segment->i;
+		float j = segment->j;
+		segment->x = xx * x + xy * y + originX;
+		segment->y = yx * x + yy * y + originY;
+		segment->i = xx * i + xy * j;
+		segment->j = yx * i + yy * j;
+	}
+}
+
+static bool IsInside(float x, float y, const ClipBounds & bounds) {
+	return (x >= bounds.minX && x <= bounds.maxX && y >= bounds.minY && y <= bounds.maxY);
+}
+
+// Keeps the clipped path in one piece. A gap left by something outside the
+// bounds is crossed with a move, and moves in a row become one move.
+static void AddPiece(CToolpath & clipped, float startX, float startY, const ToolpathSegment & piece) {
+	if (clipped.segments.empty()) {
+		clipped.MoveTo(startX, startY);
+	}
+	else {
+		ToolpathSegment & last = clipped.segments.back();
+		if (last.x != startX || last.y != startY) {
+			if (last.type == TOOLPATH_MOVE && clipped.segments.size() > 1) {
+				last.x = startX;
+				last.y = startY;
+			}
+			else {
+				clipped.MoveTo(startX, startY);
+			}
+		}
+	}
+
+	ToolpathSegment & last = clipped.segments.back();
+	if (piece.type == TOOLPATH_MOVE && last.type == TOOLPATH_MOVE && clipped.segments.size() > 1) {
+		last.x = piece.x;
+		last.y = piece.y;
+		return;
+	}
+	clipped.segments.push_back(piece);
+}
+
+// Liang-Barsky. Returns false when the line is completely outside, otherwise
+// the part from t0 to t1 of the line is inside.
+static bool ClipLine(float x0, float y0, float x1, float y1, const ClipBounds & bounds, double * t0, double * t1) {
+	double dx = (double)x1 - x0;
+	double dy = (double)y1 - y0;
+	double p[4] = { -dx, dx, -dy, dy };
+	double q[4] = { (double)x0 - bounds.minX, (double)bounds.maxX - x0, (double)y0 - bounds.minY, (double)bounds.maxY - y0 };
+	*t0 = 0;
+	*t1 = 1;
+	for (int edge = 0; edge < 4; edge++) {
+		if (p[edge] == 0) {
+			if (q[edge] < 0) {
+				return false;
+			}
+			continue;
+		}
+		double t = q[edge] / p[edge];
+		if (p[edge] < 0) {
+			*t0 = (t > *t0) ? t : *t0;
+		}
+		else {
+			*t1 = (t < *t1) ? t : *t1;
+		}
+	}
+	return (*t0 <= *t1);
+}
+
+// A point on the line, landing exactly on the edge it was clipped against
+static ToolpathPoint LinePoint(float x0, float y0, float x1, float y1, double t, const ClipBounds & bounds) {
+	ToolpathPoint point = { (float)(x0 + (x1 - x0) * t), (float)(y0 + (y1 - y0) * t) };
+	point.x = (point.x < bounds.minX) ? bounds.minX : ((point.x > bounds.maxX) ? bounds.maxX : point.x);
+	point.y = (point.y < bounds.minY) ? bounds.minY : ((point.y > bounds.maxY) ? bounds.maxY : point.y);
+	return point;
+}
+
+static void ClipLineSegment(float startX, float startY, const ToolpathSegment & segment, const ClipBounds & bounds, CToolpath & clipped, ClipReport * report) {
+	double t0, t1;
+	if (!ClipLine(startX, startY, segment.x, segment.y, bounds, &t0, &t1)) {
+		report->removedSegments++;
+		return;
+	}
+	ToolpathPoint start = { startX, startY };
+	ToolpathSegment piece = segment;
+	if (t0 > 0) {
+		start = LinePoint(startX, startY, segment.x, segment.y, t0, bounds);
+	}
+	if (t1 < 1) {
+		ToolpathPoint end = LinePoint(startX, startY, segment.x, segment.y, t1, bounds);
+		piece.x = end.x;
+		piece.y = end.y;
+	}
+	if (t0 > 0 || t1 < 1) {
+		report->clippedSegments++;
+	}
+	AddPiece(clipped, start.x, start.y, piece);
+}
+
+// Where an arc crosses an edge, as a share of the arc
+struct ArcCut
+{
+	double t;
+	int axis;		// 0 for an edge at x = value, 1 for y = value, -1 for the ends of the arc
+	float value;
+};
+
+static bool operator<(const ArcCut & a, const ArcCut & b) {
+	return a.t < b.t;
+}
+
+static void ClipArcSegment(float startX, float startY, const ToolpathSegment & segment, const ClipBounds & bounds, CToolpath & clipped, ClipReport * report) {
+	double radius, startAngle;
+	double sweep = ArcSweep(startX, startY, segment, &radius, &startAngle);
+	double centreX = startX + segment.i;
+	double centreY = startY + segment.j;
+	if (radius <= 0) {
+		ClipLineSegment(startX, startY, segment, bounds, clipped, report);
+		return;
+	}
+
+	// The whole circle is inside, nothing to cut
+	if (centreX - radius >= bounds.minX && centreX + radius <= bounds.maxX && centreY - radius >= bounds.minY && centreY + radius <= bounds.maxY) {
+		AddPiece(clipped, startX, startY, segment);
+		return;
+	}
+
+	// Each edge crosses the circle at most twice
+	ArcCut cuts[10];
+	int count = 0;
+	ArcCut first = { 0, -1, 0 };
+	cuts[count++] = first;
+	for (int edge = 0; edge < 4; edge++) {
+		int axis = edge / 2;
+		float value = (edge == 0) ? bounds.minX : (edge == 1) ? bounds.maxX : (edge == 2) ? bounds.minY : bounds.maxY;
+		double offset = (axis == 0) ? value - centreX : value - centreY;
+		if (fabs(offset) >= radius) {
+			continue;
+		}
+		double angles[2];
+		if (axis == 0) {
+			angles[0] = acos(offset / radius);
+			angles[1] = -angles[0];
+		}
+		else {
+			angles[0] = asin(offset / radius);
+			angles[1] = PLACEMENT_PI - angles[0];
+		}
+		for (int side = 0; side < 2; side++) {
+			double turned = (sweep > 0) ? angles[side] - startAngle : startAngle - angles[side];
+			turned = fmod(turned, 2 * PLACEMENT_PI);
+			if (turned < 0) {
+				turned += 2 * PLACEMENT_PI;
+			}
+			// A start on the edge can come out just short of a full turn, that is a cut at the start
+			if (2 * PLACEMENT_PI - turned < CLIP_MIN_ARC_FRACTION * fabs(sweep)) {
+				turned = 0;
+			}
+			double t = turned / fabs(sweep);
+			if (t >= 0 && t < 1) {
+				ArcCut cut = { t, axis, value };
+				cuts[count++] = cut;
+			}
+		}
+	}
+	ArcCut last = { 1, -1, 0 };
+	cuts[count++] = last;
+	std::sort(cuts + 1, cuts + count - 1);
+
+	if (count == 2) {
+		// Never crosses an edge, completely in or completely out. The ends can
+		// sit on an edge, so look at the middle of the arc.
+		double middle = startAngle + sweep / 2;
+		if (IsInside((float)(centreX + cos(middle) * radius), (float)(centreY + sin(middle) * radius), bounds)) {
+			AddPiece(clipped, startX, startY, segment);
+		}
+		else {
+			report->removedSegments++;
+		}
+		return;
+	}
+
+	double kept = 0;
+	for (int cut = 0; cut + 1 < count; cut++) {
+		const ArcCut & from = cuts[cut];
+		const ArcCut & to = cuts[cut + 1];
+		if (to.t - from.t < CLIP_MIN_ARC_FRACTION) {
+			continue;
+		}
+		double middle = startAngle + sweep * (from.t + to.t) / 2;
+		if (!IsInside((float)(centreX + cos(middle) * radius), (float)(centreY + sin(middle) * radius), bounds)) {
+			continue;
+		}
+
+		ToolpathPoint points[2];
+		const ArcCut * ends[2] = { &from, &to };
+		for (int end = 0; end < 2; end++) {
+			const ArcCut & at = *ends[end];
+			if (at.t == 0) {
+				points[end].x = startX;
+				points[end].y = startY;
+				continue;
+			}
+			if (at.t == 1) {
+				points[end].x = segment.x;
+				points[end].y = segment.y;
+				continue;
+			}
+			double angle = startAngle + sweep * at.t;
+			points[end].x = (at.axis == 0) ? at.value : (float)(centreX + cos(angle) * radius);
+			points[end].y = (at.axis == 1) ? at.value : (float)(centreY + sin(angle) * radius);
+		}
+
+		ToolpathSegment piece = segment;
+		piece.x = points[1].x;
+		piece.y = points[1].y;
+		piece.i = (float)(centreX - points[0].x);
+		piece.j = (float)(centreY - points[0].y);
+		AddPiece(clipped, points[0].x, points[0].y, piece);
+		kept += to.t - from.t;
+	}
+	if (kept <= 0) {
+		report->removedSegments++;
+	}
+	else if (kept < 1 - CLIP_MIN_ARC_FRACTION) {
+		report->clippedSegments++;
+	}
+}
+
+void ClipToolpath(const CToolpath & path, const ClipBounds & bounds, CToolpath & clipped, ClipReport * report) {
+	memset(report, 0, sizeof(ClipReport));
+	clipped.Clear();
+	if (path.segments.empty()) {
+		return;
+	}
+	clipped.segments.reserve(path.segments.size());
+
+	// The first segment only says where the path starts
+	const ToolpathSegment & first = path.segments[0];
+	if (IsInside(first.x, first.y, bounds)) {
+		clipped.segments.push_back(first);
+	}
+	else {
+		report->removedSegments++;
+	}
+
+	for (size_t index = 1; index < path.segments.size(); index++) {
+		const ToolpathSegment & segment = path.segments[index];
+		const ToolpathSegment & previous = path.segments[index - 1];
+
+		// Most of a pattern is well inside the table
+		if (segment.type == TOOLPATH_ARC_CW || segment.type == TOOLPATH_ARC_CCW) {
+			ClipArcSegment(previous.x, previous.y, segment, bounds, clipped, report);
+		}
+		else if (IsInside(previous.x, previous.y, bounds) && IsInside(segment.x, segment.y, bounds)) {
+			AddPiece(clipped, previous.x, previous.y, segment);
+		}
+		else {
+			ClipLineSegment(previous.x, previous.y, segment, bounds, clipped, report);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+// Placement.h
+//
+// Puts a pattern on the table. Patterns are drawn around (0, 0) in their own
+// units. A placement moves, scales and turns the whole toolpath into table
+// coordinates in one pass, and the clipper then cuts every line and arc
+// exactly where it crosses the edge of the table so the ball never leaves it.
+
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+#include "Toolpath.h"
+
+struct Placement
+{
+	float originX;		// Where (0, 0) of the pattern goes on the table
+	float originY;
+	float scale;
+	float rotation;		// Degrees, counter clockwise
+};
+
+struct ClipBounds
+{
+	float minX;
+	float minY;
+	float maxX;
+	float maxY;
+};
+
+struct ClipReport
+{
+	size_t clippedSegments;		// Cut where they cross the edge
+	size_t removedSegments;		// Completely outside
+};
+
+// Moves, scales and turns every segment of a path, in place
+void PlaceToolpath(CToolpath & path, const Placement & placement);
+
+// Copies the parts of a path inside the bounds to clipped. Where the path
+// leaves the bounds and comes back somewhere else the two points are joined
+// with a move, which is inside the bounds too.
+void ClipToolpath(const CToolpath & path, const ClipBounds & bounds, CToolpath & clipped, ClipReport * report);
+
+#endif
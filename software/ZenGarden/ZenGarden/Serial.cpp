@@ -2,6 +2,11 @@
 
 #include "stdafx.h"
 #include "Serial.h"
+#include "Timing.h"
+
+// How long SendImmediate waits for the driver to take the byte. One byte goes
+// out in about a millisecond even at 9600 baud.
+#define SERIAL_IMMEDIATE_TIMEOUT_US		100000
 
 CSerial::CSerial()
 {
@@ -10,6 +15,11 @@ CSerial::CSerial()
  	memset( &m_OverlappedWrite, 0, sizeof( OVERLAPPED ) );
 	m_hIDComDev = NULL;
 	m_bOpened = FALSE;
+	m_nBaud = 9600;
+
+	memset( &m_OverlappedEvent, 0, sizeof( OVERLAPPED ) );
+	m_bWatching = FALSE;
+	m_llArrival = 0;
 
 }
 
@@ -69,6 +79,7 @@ BOOL CSerial::Open( int nPort, int nBaud )
 		}
 
 	m_bOpened = TRUE;
+	m_nBaud = nBaud;
 
 	return( m_bOpened );
 
@@ -77,8 +88,11 @@ BOOL CSerial::Open( int nPort, int nBaud )
 BOOL CSerial::Close( void )
 {
 
+	m_Capture.Close();
+
 	if( !m_bOpened || m_hIDComDev == NULL ) return( TRUE );
 
+	StopArrivalWatch();
 	if( m_OverlappedRead.hEvent != NULL ) CloseHandle( m_OverlappedRead.hEvent );
 	if( m_OverlappedWrite.hEvent != NULL ) CloseHandle( m_OverlappedWrite.hEvent );
 	CloseHandle( m_hIDComDev );
@@ -113,11 +127,28 @@ int CSerial::SendData( const char *buffer, int size )
 	if( !m_bOpened || m_hIDComDev == NULL ) return( 0 );
 
 	DWORD dwBytesWritten = 0;
-	int i;
-	for( i=0; i<size; i++ ){
-		WriteCommByte( buffer[i] );
-		dwBytesWritten++;
+
+	// The whole buffer goes to the driver in one write. Allow for the time it
+	// takes to go out at the current baud rate, 10 bits a byte.
+	DWORD dwTimeout = 1000 + (DWORD) ( ( (LONGLONG) size * 10 * 1000 ) / m_nBaud );
+	BOOL bWriteStat = WriteFile( m_hIDComDev, buffer, (DWORD) size, &dwBytesWritten, &m_OverlappedWrite );
+	if( !bWriteStat && ( GetLastError() == ERROR_IO_PENDING ) ){
+		if( WaitForSingleObject( m_OverlappedWrite.hEvent, dwTimeout ) ){
+			// Still pending. The driver owns m_OverlappedWrite until the write
+			// ends, so cancel it and wait for that before the next write can
+			// use it. Whatever went out before the cancel is counted.
+			CancelIo( m_hIDComDev );
+			dwBytesWritten = 0;
+			GetOverlappedResult( m_hIDComDev, &m_OverlappedWrite, &dwBytesWritten, TRUE );
+			}
+		else{
+			GetOverlappedResult( m_hIDComDev, &m_OverlappedWrite, &dwBytesWritten, FALSE );
+			m_OverlappedWrite.Offset += dwBytesWritten;
+			}
 		}
+	// Stamped once the write is done, the controller has the whole line by
+	// then and that is what a replay waits for
+	m_Capture.Record( CAPTURE_SENT, GetTimeMicroseconds(), buffer, (int) dwBytesWritten );
 
 	return( (int) dwBytesWritten );
 
@@ -152,16 +183,139 @@ int CSerial::ReadData( void *buffer, int limit )
 	dwBytesRead = (DWORD) ComStat.cbInQue;
 	if( limit < (int) dwBytesRead ) dwBytesRead = (DWORD) limit;
 
+	// Stamp the capture with the time these bytes arrived. When they do not
+	// all fit, the rest keep the same time for the next read.
+	LONGLONG llStart = ( dwBytesRead == ComStat.cbInQue ) ? m_llArrival.exchange( 0 ) : m_llArrival.load();
+	if( llStart == 0 ) llStart = GetTimeMicroseconds();
 	bReadStatus = ReadFile( m_hIDComDev, buffer, dwBytesRead, &dwBytesRead, &m_OverlappedRead );
 	if( !bReadStatus ){
 		if( GetLastError() == ERROR_IO_PENDING ){
 			WaitForSingleObject( m_OverlappedRead.hEvent, 2000 );
+			m_Capture.Record( CAPTURE_RECEIVED, llStart, (const char *) buffer, (int) dwBytesRead );
 			return( (int) dwBytesRead );
 			}
 		return( 0 );
 		}
+	m_Capture.Record( CAPTURE_RECEIVED, llStart, (const char *) buffer, (int) dwBytesRead );
 
 	return( (int) dwBytesRead );
 
 }
 
+
+int CSerial::WriteDataWaiting( void )
+{
+
+	if( !m_bOpened || m_hIDComDev == NULL ) return( 0 );
+
+	DWORD dwErrorFlags;
+	COMSTAT ComStat;
+
+	ClearCommError( m_hIDComDev, &dwErrorFlags, &ComStat );
+
+	return( (int) ComStat.cbOutQue );
+
+}
+
+BOOL CSerial::SendImmediate( unsigned char ucByte )
+{
+
+	if( !m_bOpened || m_hIDComDev == NULL ) return( FALSE );
+
+	// The driver transmits this byte ahead of anything already waiting in the
+	// output buffer. Used for real-time control bytes (feed hold, reset, ...).
+	// It only holds one such byte and refuses the next one until the one before
+	// has gone out, so keep trying for a while.
+	LONGLONG llStart = GetTimeMicroseconds();
+	while( !TransmitCommChar( m_hIDComDev, (char) ucByte ) ){
+		if( GetTimeMicroseconds() - llStart > SERIAL_IMMEDIATE_TIMEOUT_US ) return( FALSE );
+		Sleep( 0 );
+		}
+
+	// Only bytes the driver took go in the capture
+	m_Capture.Record( CAPTURE_SENT_IMMEDIATE, GetTimeMicroseconds(), (const char *) &ucByte, 1 );
+	return( TRUE );
+
+}
+
+BOOL CSerial::PurgeOutput( void )
+{
+
+	if( !m_bOpened || m_hIDComDev == NULL ) return( FALSE );
+
+	// Abort any pending write and throw away the unsent bytes
+	m_Capture.Record( CAPTURE_PURGE, GetTimeMicroseconds(), NULL, 0 );
+	return( PurgeComm( m_hIDComDev, PURGE_TXABORT | PURGE_TXCLEAR ) );
+
+}
+
+BOOL CSerial::StartCapture( const char *szFilename )
+{
+
+	if( !m_Capture.Open( szFilename ) ) return( FALSE );
+	StartArrivalWatch();
+
+	return( TRUE );
+
+}
+
+void CSerial::StopCapture( void )
+{
+
+	StopArrivalWatch();
+	m_Capture.Close();
+
+}
+
+void CSerial::StartArrivalWatch( void )
+{
+
+	if( !m_bOpened || m_hIDComDev == NULL || m_bWatching ) return;
+
+	memset( &m_OverlappedEvent, 0, sizeof( OVERLAPPED ) );
+	m_OverlappedEvent.hEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+	if( m_OverlappedEvent.hEvent == NULL ) return;
+	if( !SetCommMask( m_hIDComDev, EV_RXCHAR ) ){
+		CloseHandle( m_OverlappedEvent.hEvent );
+		m_OverlappedEvent.hEvent = NULL;
+		return;
+		}
+
+	m_llArrival = 0;
+	m_bWatching = TRUE;
+	m_ArrivalThread = std::thread( &CSerial::WatchArrivals, this );
+
+}
+
+void CSerial::StopArrivalWatch( void )
+{
+
+	if( !m_bWatching ) return;
+
+	// Clearing the mask ends the WaitCommEvent the thread is waiting in
+	m_bWatching = FALSE;
+	SetCommMask( m_hIDComDev, 0 );
+	m_ArrivalThread.join();
+	CloseHandle( m_OverlappedEvent.hEvent );
+	m_OverlappedEvent.hEvent = NULL;
+	m_llArrival = 0;
+
+}
+
+void CSerial::WatchArrivals( void )
+{
+
+	DWORD dwEvent, dwTransferred;
+	while( m_bWatching ){
+		dwEvent = 0;
+		if( !WaitCommEvent( m_hIDComDev, &dwEvent, &m_OverlappedEvent ) ){
+			if( GetLastError() != ERROR_IO_PENDING ||
+				!GetOverlappedResult( m_hIDComDev, &m_OverlappedEvent, &dwTransferred, TRUE ) ) break;
+			}
+
+		// Only the first of the unread bytes sets the time, ReadData clears it
+		LONGLONG llUnknown = 0;
+		if( dwEvent & EV_RXCHAR ) m_llArrival.compare_exchange_strong( llUnknown, GetTimeMicroseconds() );
+		}
+
+}
@@ -4,6 +4,9 @@
 #define __SERIAL_H__
 
 #include <windows.h>
+#include <thread>
+#include <atomic>
+#include "SerialCapture.h"
 
 
 #define FC_DTRDSR       0x01
@@ -34,15 +37,36 @@ public:
 	int ReadData( void *, int );
 	int SendData( const char *, int );
 	int ReadDataWaiting( void );
+	int WriteDataWaiting( void );
+
+	BOOL SendImmediate( unsigned char );
+	BOOL PurgeOutput( void );
 
 	BOOL IsOpened( void ){ return( m_bOpened ); }
 
+	BOOL StartCapture( const char * );
+	void StopCapture( void );
+
 protected:
 	BOOL WriteCommByte( unsigned char );
 
+	// While capturing, a thread waits for incoming bytes so a capture has the
+	// time they arrived, not the time the host got round to reading them
+	void StartArrivalWatch( void );
+	void StopArrivalWatch( void );
+	void WatchArrivals( void );
+
 	HANDLE m_hIDComDev;
 	OVERLAPPED m_OverlappedRead, m_OverlappedWrite;
 	BOOL m_bOpened;
+	int m_nBaud;
+
+	CSerialCapture m_Capture;
+
+	std::thread m_ArrivalThread;
+	std::atomic<BOOL> m_bWatching;
+	std::atomic<LONGLONG> m_llArrival;	// When the first unread byte arrived, 0 if not known
+	OVERLAPPED m_OverlappedEvent;
 
 };
 
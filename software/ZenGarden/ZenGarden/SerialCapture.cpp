@@ -0,0 +1,172 @@
+// SerialCapture.cpp
+
+#include "stdafx.h"
+#include "Timing.h"
+#include "SerialCapture.h"
+#include <time.h>
+
+CSerialCapture::CSerialCapture()
+{
+
+	m_pFile = NULL;
+	m_bWriting = FALSE;
+	m_llStart = 0;
+	m_llLast = 0;
+
+}
+
+CSerialCapture::~CSerialCapture()
+{
+
+	Close();
+
+}
+
+BOOL CSerialCapture::Open( const char *szFilename )
+{
+
+	Close();
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	if( fopen_s( &m_pFile, szFilename, "wb" ) != 0 ){
+		m_pFile = NULL;
+		return( FALSE );
+		}
+	// The serial traffic is slow, a large buffer keeps the disk writes rare
+	setvbuf( m_pFile, NULL, _IOFBF, 64 * 1024 );
+
+	long long llWallClock = (long long) time( NULL );
+	unsigned char ucStart[8];
+	for( int i=0; i<8; i++ ) ucStart[i] = (unsigned char) ( llWallClock >> ( i * 8 ) );
+	fwrite( CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LENGTH, m_pFile );
+	fwrite( ucStart, 1, sizeof( ucStart ), m_pFile );
+
+	m_bWriting = TRUE;
+	m_llStart = GetTimeMicroseconds();
+	m_llLast = 0;
+
+	return( TRUE );
+
+}
+
+void CSerialCapture::Record( int nDirection, LONGLONG llTimestamp, const char *buffer, int size )
+{
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	if( m_pFile == NULL || !m_bWriting || size < 0 ) return;
+
+	LONGLONG llTime = llTimestamp - m_llStart;
+	if( llTime < m_llLast ) llTime = m_llLast;
+
+	// Long writes are split so a reader never needs more than one record buffer
+	int nOffset = 0;
+	do{
+		int nLength = size - nOffset;
+		if( nLength > CAPTURE_RECORD_MAX_LENGTH ) nLength = CAPTURE_RECORD_MAX_LENGTH;
+
+		fputc( nDirection, m_pFile );
+		WriteVarint( (unsigned long long) ( llTime - m_llLast ) );
+		WriteVarint( (unsigned long long) nLength );
+		if( nLength > 0 ) fwrite( buffer + nOffset, 1, nLength, m_pFile );
+
+		m_llLast = llTime;
+		nOffset += nLength;
+		} while( nOffset < size );
+
+	// Replies from the controller mark the end of an exchange. Flushing here
+	// keeps the file useful when the program is killed during a stall.
+	if( nDirection == CAPTURE_RECEIVED ) fflush( m_pFile );
+
+}
+
+BOOL CSerialCapture::OpenForReading( const char *szFilename )
+{
+
+	Close();
+
+	if( fopen_s( &m_pFile, szFilename, "rb" ) != 0 ){
+		m_pFile = NULL;
+		return( FALSE );
+		}
+
+	char szMagic[CAPTURE_MAGIC_LENGTH];
+	unsigned char ucStart[8];
+	if( fread( szMagic, 1, CAPTURE_MAGIC_LENGTH, m_pFile ) != CAPTURE_MAGIC_LENGTH ||
+		memcmp( szMagic, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH ) != 0 ||
+		fread( ucStart, 1, sizeof( ucStart ), m_pFile ) != sizeof( ucStart ) ){
+		Close();
+		return( FALSE );
+		}
+
+	m_bWriting = FALSE;
+	m_llStart = 0;
+	m_llLast = 0;
+
+	return( TRUE );
+
+}
+
+BOOL CSerialCapture::ReadRecord( CaptureRecord *pRecord )
+{
+
+	if( m_pFile == NULL || m_bWriting ) return( FALSE );
+
+	int nDirection = fgetc( m_pFile );
+	if( nDirection == EOF ) return( FALSE );
+
+	unsigned long long ullDelta, ullLength;
+	if( !ReadVarint( &ullDelta ) || !ReadVarint( &ullLength ) ) return( FALSE );
+	if( ullLength > CAPTURE_RECORD_MAX_LENGTH ) return( FALSE );
+
+	pRecord->nDirection = nDirection;
+	pRecord->llTime = m_llLast + (LONGLONG) ullDelta;
+	pRecord->nLength = (int) ullLength;
+	if( pRecord->nLength > 0 &&
+		fread( pRecord->data, 1, pRecord->nLength, m_pFile ) != (size_t) pRecord->nLength ) return( FALSE );
+
+	m_llLast = pRecord->llTime;
+
+	return( TRUE );
+
+}
+
+void CSerialCapture::Close( void )
+{
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	if( m_pFile == NULL ) return;
+
+	fclose( m_pFile );
+	m_pFile = NULL;
+	m_bWriting = FALSE;
+
+}
+
+void CSerialCapture::WriteVarint( unsigned long long ullValue )
+{
+
+	while( ullValue >= 0x80 ){
+		fputc( (int) ( ( ullValue & 0x7F ) | 0x80 ), m_pFile );
+		ullValue >>= 7;
+		}
+	fputc( (int) ullValue, m_pFile );
+
+}
+
+BOOL CSerialCapture::ReadVarint( unsigned long long *pullValue )
+{
+
+	unsigned long long ullValue = 0;
+	for( int nShift=0; nShift<64; nShift+=7 ){
+		int c = fgetc( m_pFile );
+		if( c == EOF ) return( FALSE );
+		ullValue |= (unsigned long long) ( c & 0x7F ) << nShift;
+		if( !( c & 0x80 ) ){
+			*pullValue = ullValue;
+			return( TRUE );
+			}
+		}
+
+	return( FALSE );
+
+}
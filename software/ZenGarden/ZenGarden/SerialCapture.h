@@ -0,0 +1,78 @@
+// SerialCapture.h
+//
+// Records every byte that goes over the serial port, with a microsecond
+// timestamp, so a session can be replayed later (see ZenReplay).
+//
+// File layout
+//   "ZGC1"                    magic, 4 bytes
+//   start time                time_t of the capture start, 8 bytes little endian
+//   records...
+//
+// Record layout
+//   direction                 1 byte, one of CAPTURE_*
+//   time delta                varint, microseconds since the previous record
+//   length                    varint, number of data bytes
+//   data                      length bytes
+//
+// Varints are unsigned LEB128, 7 bits per byte, low bits first.
+
+#ifndef __SERIAL_CAPTURE_H__
+#define __SERIAL_CAPTURE_H__
+
+#include <windows.h>
+#include <stdio.h>
+#include <mutex>
+
+
+#define CAPTURE_MAGIC				"ZGC1"
+#define CAPTURE_MAGIC_LENGTH		4
+
+#define CAPTURE_SENT				0x01	// Host to controller, timed when the write finished
+#define CAPTURE_RECEIVED			0x02	// Controller to host, timed when the first byte arrived
+#define CAPTURE_SENT_IMMEDIATE		0x03	// Host to controller, real-time byte ahead of the queue
+#define CAPTURE_PURGE				0x04	// Host discarded its unsent output, no data
+
+#define CAPTURE_RECORD_MAX_LENGTH	4096
+
+struct CaptureRecord
+{
+	int nDirection;
+	LONGLONG llTime;			// Microseconds since the start of the capture
+	int nLength;
+	char data[CAPTURE_RECORD_MAX_LENGTH];
+};
+
+class CSerialCapture
+{
+
+public:
+	CSerialCapture();
+	~CSerialCapture();
+
+	// Writing
+	BOOL Open( const char *szFilename );
+	void Record( int nDirection, LONGLONG llTimestamp, const char *buffer, int size );
+
+	// Reading
+	BOOL OpenForReading( const char *szFilename );
+	BOOL ReadRecord( CaptureRecord *pRecord );
+
+	void Close( void );
+
+	BOOL IsOpened( void ){ return( m_pFile != NULL ); }
+
+protected:
+	void WriteVarint( unsigned long long ullValue );
+	BOOL ReadVarint( unsigned long long *pullValue );
+
+	FILE *m_pFile;
+	BOOL m_bWriting;
+	LONGLONG m_llStart;			// Timestamp the capture started
+	LONGLONG m_llLast;			// Time of the previous record, relative to m_llStart
+
+	// The keyboard thread records real-time bytes while the main thread records the rest
+	std::mutex m_Mutex;
+
+};
+
+#endif
@@ -0,0 +1,513 @@
+// StrokeOrder.cpp
+
+#include "stdafx.h"
+#include "StrokeOrder.h"
+#include "Timing.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Improvements smaller than this are rounding, not worth a move
+#define STROKE_ORDER_MIN_GAIN			0.001f
+
+// Positions handled between two looks at the clock
+#define STROKE_ORDER_CLOCK_INTERVAL		64
+
+float CStrokeOptimizer::Distance(int a, int b) const {
+	if (a < 0 || b < 0) {
+		return 0;
+	}
+	float dx = this->m_ends[a].x - this->m_ends[b].x;
+	float dy = this->m_ends[a].y - this->m_ends[b].y;
+	return sqrtf(dx * dx + dy * dy);
+}
+
+int CStrokeOptimizer::GetEntry(int position) const {
+	if (position >= (int)this->m_order.size()) {
+		return -1;
+	}
+	int stroke = this->m_order[position];
+	return stroke * 2 + this->m_reversed[stroke];
+}
+
+int CStrokeOptimizer::GetExit(int position) const {
+	if (position < 0) {
+		return (int)this->m_strokes.size() * 2;
+	}
+	return GetEntry(position) ^ 1;
+}
+
+void CStrokeOptimizer::BuildGrid() {
+	int ends = (int)this->m_strokes.size() * 2;
+	float minX = this->m_ends[0].x;
+	float maxX = minX;
+	float minY = this->m_ends[0].y;
+	float maxY = minY;
+	for (int end = 1; end < ends; end++) {
+		minX = (this->m_ends[end].x < minX) ? this->m_ends[end].x : minX;
+		maxX = (this->m_ends[end].x > maxX) ? this->m_ends[end].x : maxX;
+		minY = (this->m_ends[end].y < minY) ? this->m_ends[end].y : minY;
+		maxY = (this->m_ends[end].y > maxY) ? this->m_ends[end].y : maxY;
+	}
+
+	// About one stroke end per cell
+	float width = maxX - minX;
+	float height = maxY - minY;
+	this->m_cellSize = sqrtf((width * height) / ends);
+	if (this->m_cellSize < (width + height) / ends) {
+		this->m_cellSize = (width + height) / ends;
+	}
+	if (this->m_cellSize <= 0) {
+		this->m_cellSize = 1;
+	}
+	this->m_minX = minX;
+	this->m_minY = minY;
+	this->m_columns = (int)(width / this->m_cellSize) + 1;
+	this->m_rows = (int)(height / this->m_cellSize) + 1;
+
+	int cells = this->m_columns * this->m_rows;
+	this->m_cellStart.assign(cells + 1, 0);
+	this->m_cellCount.assign(cells, 0);
+	this->m_cellEnds.resize(ends);
+	this->m_endSlot.resize(ends);
+	for (int end = 0; end < ends; end++) {
+		this->m_cellStart[GetCell(this->m_ends[end]) + 1]++;
+	}
+	for (int cell = 0; cell < cells; cell++) {
+		this->m_cellStart[cell + 1] += this->m_cellStart[cell];
+	}
+	for (int end = 0; end < ends; end++) {
+		int cell = GetCell(this->m_ends[end]);
+		int slot = this->m_cellStart[cell] + this->m_cellCount[cell]++;
+		this->m_cellEnds[slot] = end;
+		this->m_endSlot[end] = slot;
+	}
+}
+
+// Only for stroke ends, they are all inside the grid
+int CStrokeOptimizer::GetCell(ToolpathPoint point) const {
+	int column = (int)((point.x - this->m_minX) / this->m_cellSize);
+	int row = (int)((point.y - this->m_minY) / this->m_cellSize);
+	column = (column < this->m_columns) ? column : this->m_columns - 1;
+	row = (row < this->m_rows) ? row : this->m_rows - 1;
+	return row * this->m_columns + column;
+}
+
+// Takes an end out of its cell by swapping it with the last one there
+void CStrokeOptimizer::RemoveEnd(int end) {
+	int slot = this->m_endSlot[end];
+	if (slot < 0) {
+		return;
+	}
+	int cell = GetCell(this->m_ends[end]);
+	int lastSlot = this->m_cellStart[cell] + --this->m_cellCount[cell];
+	int last = this->m_cellEnds[lastSlot];
+	this->m_cellEnds[slot] = last;
+	this->m_endSlot[last] = slot;
+	this->m_cellEnds[lastSlot] = end;
+	this->m_endSlot[end] = -1;
+}
+
+// Rings around a cell it takes to reach every cell of the grid
+static int GetRings(int columns, int rows, int column, int row) {
+	int rings = abs(column);
+	rings = (abs(columns - 1 - column) > rings) ? abs(columns - 1 - column) : rings;
+	rings = (abs(row) > rings) ? abs(row) : rings;
+	rings = (abs(rows - 1 - row) > rings) ? abs(rows - 1 - row) : rings;
+	return rings;
+}
+
+void CStrokeOptimizer::FindNeighbours() {
+	int ends = (int)this->m_strokes.size() * 2;
+	this->m_neighbours.assign((size_t)(ends + 1) * STROKE_ORDER_NEIGHBOURS, -1);
+	float distances[STROKE_ORDER_NEIGHBOURS];
+	for (int end = 0; end <= ends; end++) {
+		ToolpathPoint point = this->m_ends[end];
+		int * neighbours = &this->m_neighbours[(size_t)end * STROKE_ORDER_NEIGHBOURS];
+		int found = 0;
+		int centreColumn = (int)floorf((point.x - this->m_minX) / this->m_cellSize);
+		int centreRow = (int)floorf((point.y - this->m_minY) / this->m_cellSize);
+		int rings = GetRings(this->m_columns, this->m_rows, centreColumn, centreRow);
+
+		// Rings of cells further and further out, until nothing closer can be left
+		for (int ring = 0; ring <= rings; ring++) {
+			if (found == STROKE_ORDER_NEIGHBOURS && distances[found - 1] <= (ring - 1) * this->m_cellSize) {
+				break;
+			}
+			for (int row = centreRow - ring; row <= centreRow + ring; row++) {
+				if (row < 0 || row >= this->m_rows) {
+					continue;
+				}
+				bool edgeRow = (row == centreRow - ring || row == centreRow + ring);
+				for (int column = centreColumn - ring; column <= centreColumn + ring; column += (edgeRow || ring == 0) ? 1 : 2 * ring) {
+					if (column < 0 || column >= this->m_columns) {
+						continue;
+					}
+					int cell = row * this->m_columns + column;
+					for (int slot = this->m_cellStart[cell]; slot < this->m_cellStart[cell] + this->m_cellCount[cell]; slot++) {
+						int other = this->m_cellEnds[slot];
+						if (other == end || other == (end ^ 1)) {
+							continue;
+						}
+						float distance = Distance(end, other);
+						if (found == STROKE_ORDER_NEIGHBOURS && distance >= distances[found - 1]) {
+							continue;
+						}
+						// Insert in order, dropping the furthest when full
+						int insert = (found < STROKE_ORDER_NEIGHBOURS) ? found++ : found - 1;
+						while (insert > 0 && distances[insert - 1] > distance) {
+							distances[insert] = distances[insert - 1];
+							neighbours[insert] = neighbours[insert - 1];
+							insert--;
+						}
+						distances[insert] = distance;
+						neighbours[insert] = other;
+					}
+				}
+			}
+		}
+	}
+}
+
+void CStrokeOptimizer::NearestNeighbourOrder(bool allowReverse) {
+	int strokes = (int)this->m_strokes.size();
+
+	if (!allowReverse) {
+		for (int stroke = 0; stroke < strokes; stroke++) {
+			RemoveEnd(stroke * 2 + 1);
+		}
+	}
+
+	this->m_order.resize(strokes);
+	this->m_reversed.assign(strokes, 0);
+	this->m_position.resize(strokes);
+
+	int exit = strokes * 2;
+	for (int position = 0; position < strokes; position++) {
+		ToolpathPoint point = this->m_ends[exit];
+		int centreColumn = (int)floorf((point.x - this->m_minX) / this->m_cellSize);
+		int centreRow = (int)floorf((point.y - this->m_minY) / this->m_cellSize);
+		int rings = GetRings(this->m_columns, this->m_rows, centreColumn, centreRow);
+		int nearest = -1;
+		float nearestDistance = 0;
+		for (int ring = 0; ring <= rings; ring++) {
+			if (nearest >= 0 && nearestDistance <= (ring - 1) * this->m_cellSize) {
+				break;
+			}
+			for (int row = centreRow - ring; row <= centreRow + ring; row++) {
+				if (row < 0 || row >= this->m_rows) {
+					continue;
+				}
+				bool edgeRow = (row == centreRow - ring || row == centreRow + ring);
+				for (int column = centreColumn - ring; column <= centreColumn + ring; column += (edgeRow || ring == 0) ? 1 : 2 * ring) {
+					if (column < 0 || column >= this->m_columns) {
+						continue;
+					}
+					int cell = row * this->m_columns + column;
+					for (int slot = this->m_cellStart[cell]; slot < this->m_cellStart[cell] + this->m_cellCount[cell]; slot++) {
+						int other = this->m_cellEnds[slot];
+						float distance = Distance(exit, other);
+						if (nearest < 0 || distance < nearestDistance || (distance == nearestDistance && other < nearest)) {
+							nearest = other;
+							nearestDistance = distance;
+						}
+					}
+				}
+			}
+		}
+
+		int stroke = nearest / 2;
+		this->m_order[position] = stroke;
+		this->m_reversed[stroke] = (unsigned char)(nearest & 1);
+		this->m_position[stroke] = position;
+		RemoveEnd(stroke * 2);
+		RemoveEnd(stroke * 2 + 1);
+		exit = nearest ^ 1;
+	}
+}
+
+// Draws the strokes from first to last in the opposite order, and each of them backwards
+void CStrokeOptimizer::Reverse(int first, int last) {
+	std::reverse(this->m_order.begin() + first, this->m_order.begin() + last + 1);
+	for (int position = first; position <= last; position++) {
+		int stroke = this->m_order[position];
+		this->m_reversed[stroke] ^= 1;
+		this->m_position[stroke] = position;
+	}
+}
+
+// Swaps two stroke ends for each other. Only possible when strokes can be
+// drawn backwards, reversing a run keeps the travel inside it the same.
+bool CStrokeOptimizer::TwoOpt(long long deadline) {
+	int strokes = (int)this->m_order.size();
+	bool improved = false;
+	for (int position = 0; position < strokes; position++) {
+		if (position % STROKE_ORDER_CLOCK_INTERVAL == 0 && GetTimeMicroseconds() >= deadline) {
+			break;
+		}
+
+		// Connect the exit before this position to the exit of a later stroke
+		int exit = GetExit(position - 1);
+		int entry = GetEntry(position);
+		float current = Distance(exit, entry);
+		const int * neighbours = &this->m_neighbours[(size_t)exit * STROKE_ORDER_NEIGHBOURS];
+		for (int candidate = 0; candidate < STROKE_ORDER_NEIGHBOURS && neighbours[candidate] >= 0; candidate++) {
+			int other = neighbours[candidate];
+			float shortcut = Distance(exit, other);
+			if (shortcut >= current) {
+				break;
+			}
+			int last = this->m_position[other / 2];
+			if (last < position || GetExit(last) != other) {
+				continue;
+			}
+			int next = GetEntry(last + 1);
+			float gain = current + Distance(other, next) - shortcut - Distance(entry, next);
+			if (gain > STROKE_ORDER_MIN_GAIN) {
+				Reverse(position, last);
+				improved = true;
+				break;
+			}
+		}
+
+		// Connect the entry at this position to the entry of an earlier stroke
+		exit = GetExit(position - 1);
+		entry = GetEntry(position);
+		current = Distance(exit, entry);
+		neighbours = &this->m_neighbours[(size_t)entry * STROKE_ORDER_NEIGHBOURS];
+		for (int candidate = 0; candidate < STROKE_ORDER_NEIGHBOURS && neighbours[candidate] >= 0; candidate++) {
+			int other = neighbours[candidate];
+			float shortcut = Distance(entry, other);
+			if (shortcut >= current) {
+				break;
+			}
+			int first = this->m_position[other / 2];
+			if (first >= position || GetEntry(first) != other) {
+				continue;
+			}
+			int previous = GetExit(first - 1);
+			float gain = Distance(previous, other) + current - Distance(previous, exit) - shortcut;
+			if (gain > STROKE_ORDER_MIN_GAIN) {
+				Reverse(first, position - 1);
+				improved = true;
+				break;
+			}
+		}
+	}
+	return improved;
+}
+
+// Moves a run of up to STROKE_ORDER_OR_OPT_LENGTH strokes to between two
+// other strokes close to its ends, backwards if that is shorter and allowed
+bool CStrokeOptimizer::OrOpt(bool allowReverse, long long deadline) {
+	int strokes = (int)this->m_order.size();
+	bool improved = false;
+	for (int first = 0; first < strokes; first++) {
+		if (first % STROKE_ORDER_CLOCK_INTERVAL == 0 && GetTimeMicroseconds() >= deadline) {
+			break;
+		}
+		for (int length = 1; length <= STROKE_ORDER_OR_OPT_LENGTH && first + length <= strokes; length++) {
+			int last = first + length - 1;
+			int before = GetExit(first - 1);
+			int entry = GetEntry(first);
+			int exit = GetExit(last);
+			int after = GetEntry(last + 1);
+			float removed = Distance(before, entry) + Distance(exit, after) - Distance(before, after);
+			if (removed <= STROKE_ORDER_MIN_GAIN) {
+				continue;
+			}
+
+			// Each candidate is a gap, the position the run would follow
+			int bestGap = -2;
+			bool bestBackwards = false;
+			float bestAdded = removed - STROKE_ORDER_MIN_GAIN;
+			for (int side = 0; side < 2; side++) {
+				bool backwards = (side == 1);
+				if (backwards && !allowReverse) {
+					break;
+				}
+				// Forwards the run is entered at entry, backwards at exit
+				int runEntry = backwards ? exit : entry;
+				int runExit = backwards ? entry : exit;
+				for (int near = 0; near < 2; near++) {
+					int end = (near == 0) ? runEntry : runExit;
+					const int * neighbours = &this->m_neighbours[(size_t)end * STROKE_ORDER_NEIGHBOURS];
+					for (int candidate = 0; candidate < STROKE_ORDER_NEIGHBOURS && neighbours[candidate] >= 0; candidate++) {
+						int other = neighbours[candidate];
+						if (Distance(end, other) >= bestAdded) {
+							break;
+						}
+						// Near the run entry the gap is after other, near the run exit it is before it
+						int otherPosition = this->m_position[other / 2];
+						int gap;
+						if (near == 0) {
+							if (GetExit(otherPosition) != other) {
+								continue;
+							}
+							gap = otherPosition;
+						}
+						else {
+							if (GetEntry(otherPosition) != other) {
+								continue;
+							}
+							gap = otherPosition - 1;
+						}
+						if (gap >= first - 1 && gap <= last) {
+							continue;
+						}
+						int gapExit = GetExit(gap);
+						int gapEntry = GetEntry(gap + 1);
+						float added = Distance(gapExit, runEntry) + Distance(runExit, gapEntry) - Distance(gapExit, gapEntry);
+						if (added < bestAdded) {
+							bestAdded = added;
+							bestGap = gap;
+							bestBackwards = backwards;
+						}
+					}
+				}
+			}
+			if (bestGap == -2) {
+				continue;
+			}
+
+			// Rotate the run into the gap, then turn it around if needed
+			int moved;
+			if (bestGap > last) {
+				std::rotate(this->m_order.begin() + first, this->m_order.begin() + last + 1, this->m_order.begin() + bestGap + 1);
+				moved = bestGap - length + 1;
+				for (int position = first; position <= bestGap; position++) {
+					this->m_position[this->m_order[position]] = position;
+				}
+			}
+			else {
+				std::rotate(this->m_order.begin() + bestGap + 1, this->m_order.begin() + first, this->m_order.begin() + last + 1);
+				moved = bestGap + 1;
+				for (int position = bestGap + 1; position <= last; position++) {
+					this->m_position[this->m_order[position]] = position;
+				}
+			}
+			if (bestBackwards) {
+				Reverse(moved, moved + length - 1);
+			}
+			improved = true;
+			break;
+		}
+	}
+	return improved;
+}
+
+float CStrokeOptimizer::GetTravel() const {
+	float travel = 0;
+	for (int position = 0; position < (int)this->m_order.size(); position++) {
+		travel += Distance(GetExit(position - 1), GetEntry(position));
+	}
+	return travel;
+}
+
+void CStrokeOptimizer::Optimize(const CToolpath & path, bool allowReverse, long long budgetUs, StrokeOrderReport * report, CToolpath & optimized) {
+	long long started = GetTimeMicroseconds();
+	memset(report, 0, sizeof(StrokeOrderReport));
+	optimized.Clear();
+	if (path.segments.empty()) {
+		return;
+	}
+
+	// Split in strokes, the moves between them are the travel
+	this->m_strokes.clear();
+	size_t index = 1;
+	size_t drawnEnd = 1;
+	while (index < path.segments.size()) {
+		while (index < path.segments.size() && path.segments[index].type == TOOLPATH_MOVE) {
+			index++;
+		}
+		Stroke stroke;
+		stroke.first = index;
+		while (index < path.segments.size() && path.segments[index].type != TOOLPATH_MOVE) {
+			index++;
+		}
+		if (index > stroke.first) {
+			stroke.last = index;
+			stroke.start = path.GetStart(stroke.first);
+			stroke.end = path.GetStart(stroke.last);
+			this->m_strokes.push_back(stroke);
+			drawnEnd = index;
+		}
+	}
+	for (index = 1; index < drawnEnd; index++) {
+		if (path.segments[index].type == TOOLPATH_MOVE) {
+			report->travelBefore += SegmentLength(path.GetStart(index).x, path.GetStart(index).y, path.segments[index]);
+		}
+	}
+	report->strokes = this->m_strokes.size();
+	report->travelAfter = report->travelBefore;
+	if (this->m_strokes.size() < 2) {
+		optimized.segments.assign(path.segments.begin(), path.segments.begin() + drawnEnd);
+		report->elapsedUs = GetTimeMicroseconds() - started;
+		return;
+	}
+
+	int strokes = (int)this->m_strokes.size();
+	this->m_ends.resize(strokes * 2 + 1);
+	for (int stroke = 0; stroke < strokes; stroke++) {
+		this->m_ends[stroke * 2] = this->m_strokes[stroke].start;
+		this->m_ends[stroke * 2 + 1] = this->m_strokes[stroke].end;
+	}
+	this->m_ends[strokes * 2] = path.GetStart(0);
+
+	BuildGrid();
+	FindNeighbours();
+	NearestNeighbourOrder(allowReverse);
+
+	long long deadline = started + budgetUs;
+	bool improved = true;
+	while (improved && GetTimeMicroseconds() < deadline) {
+		report->passes++;
+		improved = allowReverse && TwoOpt(deadline);
+		improved = OrOpt(allowReverse, deadline) || improved;
+	}
+	report->outOfTime = improved;
+	report->travelAfter = GetTravel();
+
+	// Nearest neighbour can be worse than a hand made order, keep whichever is shorter
+	if (report->travelAfter >= report->travelBefore) {
+		report->travelAfter = report->travelBefore;
+		optimized.segments.assign(path.segments.begin(), path.segments.begin() + drawnEnd);
+		report->elapsedUs = GetTimeMicroseconds() - started;
+		return;
+	}
+
+	optimized.segments.reserve(path.segments.size());
+	optimized.segments.push_back(path.segments[0]);
+	int exit = strokes * 2;
+	for (int position = 0; position < strokes; position++) {
+		int entry = GetEntry(position);
+		if (Distance(exit, entry) > 0) {
+			optimized.MoveTo(this->m_ends[entry].x, this->m_ends[entry].y);
+		}
+		const Stroke & stroke = this->m_strokes[entry / 2];
+		if ((entry & 1) == 0) {
+			optimized.segments.insert(optimized.segments.end(), path.segments.begin() + stroke.first, path.segments.begin() + stroke.last);
+		}
+		else {
+			// Backwards, every segment runs from its end to its start. Arcs turn
+			// the other way around the same centre.
+			report->reversedStrokes++;
+			for (size_t segment = stroke.last; segment-- > stroke.first; ) {
+				const ToolpathSegment & forwards = path.segments[segment];
+				ToolpathPoint start = path.GetStart(segment);
+				ToolpathSegment backwards = forwards;
+				backwards.x = start.x;
+				backwards.y = start.y;
+				if (forwards.type == TOOLPATH_ARC_CW || forwards.type == TOOLPATH_ARC_CCW) {
+					backwards.type = (forwards.type == TOOLPATH_ARC_CW) ? TOOLPATH_ARC_CCW : TOOLPATH_ARC_CW;
+					backwards.i = start.x + forwards.i - forwards.x;
+					backwards.j = start.y + forwards.j - forwards.y;
+				}
+				optimized.segments.push_back(backwards);
+			}
+		}
+		exit = entry ^ 1;
+	}
+	report->elapsedUs = GetTimeMicroseconds() - started;
+}
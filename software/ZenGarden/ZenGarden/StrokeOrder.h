@@ -0,0 +1,92 @@
+// StrokeOrder.h
+//
+// Reorders the strokes of a toolpath to cut down the travel between them.
+// A stroke is a run of segments between two moves. The ball drags through
+// the sand on every move too, so less travel is both faster and cleaner.
+//
+// The order starts out nearest neighbour first, then gets better with 2-opt
+// and Or-opt moves until nothing improves or the time budget runs out. Every
+// stroke end keeps a list of the stroke ends closest to it, found with a
+// uniform grid, so each improvement pass only looks at nearby candidates.
+
+#ifndef __STROKE_ORDER_H__
+#define __STROKE_ORDER_H__
+
+#include <vector>
+#include "Toolpath.h"
+
+// Candidates kept for every stroke end
+#define STROKE_ORDER_NEIGHBOURS			8
+
+// Longest run of strokes moved at once by Or-opt
+#define STROKE_ORDER_OR_OPT_LENGTH		3
+
+struct StrokeOrderReport
+{
+	size_t strokes;
+	size_t reversedStrokes;
+	float travelBefore;
+	float travelAfter;
+	int passes;				// Improvement passes over the whole order
+	bool outOfTime;			// Stopped by the time budget, not because it was done
+	long long elapsedUs;
+};
+
+class CStrokeOptimizer
+{
+	public:
+		// The first segment stays first, it is where the path starts. Travel at
+		// the very end is dropped, there is nothing left to draw there. Strokes
+		// are only drawn backwards when allowReverse is set. The search stops
+		// after budgetUs microseconds with the best order found so far.
+		void Optimize(const CToolpath & path, bool allowReverse, long long budgetUs, StrokeOrderReport * report, CToolpath & optimized);
+
+	private:
+		struct Stroke
+		{
+			size_t first;			// First segment
+			size_t last;			// One past the last segment
+			ToolpathPoint start;
+			ToolpathPoint end;
+		};
+
+		// Stroke ends are numbered stroke * 2 for the start and stroke * 2 + 1
+		// for the end. The start of the path is number strokes * 2.
+		float Distance(int a, int b) const;
+
+		// Where the order enters and leaves the stroke at a position, -1 past the end
+		int GetEntry(int position) const;
+		int GetExit(int position) const;
+
+		void BuildGrid();
+		int GetCell(ToolpathPoint point) const;
+		void RemoveEnd(int end);
+		void FindNeighbours();
+		void NearestNeighbourOrder(bool allowReverse);
+		bool TwoOpt(long long deadline);
+		bool OrOpt(bool allowReverse, long long deadline);
+		void Reverse(int first, int last);
+		float GetTravel() const;
+
+		std::vector<Stroke> m_strokes;
+		std::vector<ToolpathPoint> m_ends;
+
+		// Uniform grid of stroke ends, each cell is a range of m_cellEnds
+		std::vector<int> m_cellStart;
+		std::vector<int> m_cellCount;
+		std::vector<int> m_cellEnds;
+		std::vector<int> m_endSlot;		// Where each end is in m_cellEnds, for removing it
+		int m_columns;
+		int m_rows;
+		float m_minX;
+		float m_minY;
+		float m_cellSize;
+
+		std::vector<int> m_neighbours;	// STROKE_ORDER_NEIGHBOURS per end, closest first, -1 for none
+
+		std::vector<int> m_order;		// Stroke at each position
+		std::vector<unsigned char> m_reversed;	// Per stroke
+		std::vector<int> m_position;	// Per stroke
+};
+
+#endif
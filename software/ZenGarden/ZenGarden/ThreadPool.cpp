@@ -0,0 +1,98 @@
+// ThreadPool.cpp
+
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+CThreadPool::CThreadPool(int threads) {
+	this->m_job = NULL;
+	this->m_count = 0;
+	this->m_next = 0;
+	this->m_busy = 0;
+	this->m_generation = 0;
+	this->m_stop = false;
+
+	if (threads <= 0) {
+		threads = (int)std::thread::hardware_concurrency();
+	}
+	for (int worker = 1; worker < threads; worker++) {
+		this->m_workers.push_back(std::thread(&CThreadPool::Worker, this));
+	}
+}
+
+CThreadPool::~CThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+		this->m_stop = true;
+	}
+	this->m_wake.notify_all();
+	for (size_t worker = 0; worker < this->m_workers.size(); worker++) {
+		this->m_workers[worker].join();
+	}
+}
+
+void CThreadPool::Run(CParallelJob & job, size_t count) {
+	if (count == 0) {
+		return;
+	}
+	if (this->m_workers.empty() || count == 1) {
+		this->m_next = 0;
+		Work(job, count);
+		return;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+		this->m_job = &job;
+		this->m_count = count;
+		this->m_next = 0;
+		this->m_busy = this->m_workers.size();
+		this->m_generation++;
+	}
+	this->m_wake.notify_all();
+
+	Work(job, count);
+
+	std::unique_lock<std::mutex> lock(this->m_mutex);
+	while (this->m_busy > 0) {
+		this->m_done.wait(lock);
+	}
+	this->m_job = NULL;
+}
+
+void CThreadPool::Worker() {
+	unsigned int generation = 0;
+	for (;;) {
+		CParallelJob * job;
+		size_t count;
+		{
+			std::unique_lock<std::mutex> lock(this->m_mutex);
+			while (!this->m_stop && this->m_generation == generation) {
+				this->m_wake.wait(lock);
+			}
+			if (this->m_stop) {
+				return;
+			}
+			generation = this->m_generation;
+			job = this->m_job;
+			count = this->m_count;
+		}
+
+		Work(*job, count);
+
+		std::unique_lock<std::mutex> lock(this->m_mutex);
+		this->m_busy--;
+		if (this->m_busy == 0) {
+			this->m_done.notify_all();
+		}
+	}
+}
+
+void CThreadPool::Work(CParallelJob & job, size_t count) {
+	for (;;) {
+		size_t index = this->m_next++;
+		if (index >= count) {
+			return;
+		}
+		job.Run(index);
+	}
+}
@@ -0,0 +1,52 @@
+// ThreadPool.h
+//
+// A fixed set of worker threads that run the indexes of a job in parallel.
+// The thread that calls Run works on the job too and Run only returns once
+// every index is done.
+
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+class CParallelJob
+{
+	public:
+		virtual ~CParallelJob() {}
+		virtual void Run(size_t index) = 0;
+};
+
+class CThreadPool
+{
+	public:
+		// threads is the total including the caller, 0 uses every core
+		CThreadPool(int threads = 0);
+		~CThreadPool();
+
+		// Calls job.Run(index) for every index below count, in any order
+		void Run(CParallelJob & job, size_t count);
+
+		int GetThreads() const { return (int)this->m_workers.size() + 1; }
+
+	private:
+		void Worker();
+		void Work(CParallelJob & job, size_t count);
+
+		std::vector<std::thread> m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+
+		CParallelJob * m_job;
+		size_t m_count;
+		std::atomic<size_t> m_next;
+		size_t m_busy;				// Workers still on the current job
+		unsigned int m_generation;	// Bumped for every job so the workers see a new one
+		bool m_stop;
+};
+
+#endif
@@ -0,0 +1,20 @@
+// Timing.cpp
+
+#include "stdafx.h"
+#include "Timing.h"
+#include <windows.h>
+
+long long GetTimeMicroseconds( void )
+{
+
+	static LARGE_INTEGER liFrequency = { 0 };
+	if( liFrequency.QuadPart == 0 ) QueryPerformanceFrequency( &liFrequency );
+
+	LARGE_INTEGER liNow;
+	QueryPerformanceCounter( &liNow );
+
+	// Split the division so the multiply can not overflow on long uptimes
+	return( ( liNow.QuadPart / liFrequency.QuadPart ) * 1000000 +
+		( ( liNow.QuadPart % liFrequency.QuadPart ) * 1000000 ) / liFrequency.QuadPart );
+
+}
@@ -0,0 +1,13 @@
+// Timing.h
+//
+// Microsecond clock shared by the serial layer, the keyboard and the
+// pattern stages. Kept apart so code that only needs the time does not
+// pull in windows.h.
+
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+// Microseconds from the high resolution performance counter
+long long GetTimeMicroseconds( void );
+
+#endif
@@ -0,0 +1,87 @@
+// Toolpath.cpp
+
+#include "stdafx.h"
+#include "Toolpath.h"
+#include <math.h>
+
+#define TOOLPATH_PI					3.14159265358979323846
+
+void CToolpath::MoveTo(float x, float y) {
+	ToolpathSegment segment = { TOOLPATH_MOVE, x, y, 0, 0 };
+	this->segments.push_back(segment);
+}
+
+void CToolpath::LineTo(float x, float y) {
+	ToolpathSegment segment = { TOOLPATH_LINE, x, y, 0, 0 };
+	this->segments.push_back(segment);
+}
+
+void CToolpath::ArcTo(float x, float y, float i, float j, bool clockwise) {
+	ToolpathSegment segment = { clockwise ? TOOLPATH_ARC_CW : TOOLPATH_ARC_CCW, x, y, i, j };
+	this->segments.push_back(segment);
+}
+
+void CToolpath::Clear() {
+	this->segments.clear();
+}
+
+ToolpathPoint CToolpath::GetStart(size_t index) const {
+	const ToolpathSegment & previous = this->segments[(index > 0) ? index - 1 : 0];
+	ToolpathPoint start = { previous.x, previous.y };
+	return start;
+}
+
+float CToolpath::Length() const {
+	float length = 0;
+	for (size_t index = 1; index < this->segments.size(); index++) {
+		const ToolpathSegment & previous = this->segments[index - 1];
+		length += SegmentLength(previous.x, previous.y, this->segments[index]);
+	}
+	return length;
+}
+
+double ArcSweep(float startX, float startY, const ToolpathSegment & segment, double * radius, double * startAngle) {
+	double centreX = startX + segment.i;
+	double centreY = startY + segment.j;
+	*radius = sqrt((double)segment.i * segment.i + (double)segment.j * segment.j);
+	*startAngle = atan2(startY - centreY, startX - centreX);
+	double endAngle = atan2(segment.y - centreY, segment.x - centreX);
+
+	double sweep = (segment.type == TOOLPATH_ARC_CCW) ? endAngle - *startAngle : *startAngle - endAngle;
+	while (sweep <= 0) {
+		sweep += 2 * TOOLPATH_PI;
+	}
+	return (segment.type == TOOLPATH_ARC_CCW) ? sweep : -sweep;
+}
+
+float SegmentLength(float startX, float startY, const ToolpathSegment & segment) {
+	if (segment.type == TOOLPATH_ARC_CW || segment.type == TOOLPATH_ARC_CCW) {
+		double radius, startAngle;
+		double sweep = ArcSweep(startX, startY, segment, &radius, &startAngle);
+		return (float)(fabs(sweep) * radius);
+	}
+	float dx = segment.x - startX;
+	float dy = segment.y - startY;
+	return sqrtf(dx * dx + dy * dy);
+}
+
+void FlattenSegment(float startX, float startY, const ToolpathSegment & segment, float maxChord, std::vector<ToolpathPoint> & points) {
+	if (segment.type == TOOLPATH_ARC_CW || segment.type == TOOLPATH_ARC_CCW) {
+		double radius, startAngle;
+		double sweep = ArcSweep(startX, startY, segment, &radius, &startAngle);
+		int steps = (int)ceil(fabs(sweep) * radius / maxChord);
+		if (steps < 1) {
+			steps = 1;
+		}
+		double centreX = startX + segment.i;
+		double centreY = startY + segment.j;
+		for (int step = 1; step < steps; step++) {
+			double angle = startAngle + sweep * step / steps;
+			ToolpathPoint point = { (float)(centreX + cos(angle) * radius), (float)(centreY + sin(angle) * radius) };
+			points.push_back(point);
+		}
+	}
+	// Always finish exactly on the end point
+	ToolpathPoint end = { segment.x, segment.y };
+	points.push_back(end);
+}
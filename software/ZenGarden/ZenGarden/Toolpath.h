@@ -0,0 +1,60 @@
+// Toolpath.h
+//
+// A pattern as a list of segments. Patterns build a toolpath first and the
+// plotter draws it afterwards, so the whole path can be analysed and cleaned
+// up before anything is sent to the table.
+
+#ifndef __TOOLPATH_H__
+#define __TOOLPATH_H__
+
+#include <vector>
+
+#define TOOLPATH_MOVE				0	// Travel to the start of a new stroke
+#define TOOLPATH_LINE				1
+#define TOOLPATH_ARC_CW				2
+#define TOOLPATH_ARC_CCW			3
+
+struct ToolpathPoint
+{
+	float x;
+	float y;
+};
+
+struct ToolpathSegment
+{
+	int type;
+	float x, y;		// End point
+	float i, j;		// Arcs only, centre relative to the start point
+};
+
+class CToolpath
+{
+	public:
+		std::vector<ToolpathSegment> segments;
+
+		void MoveTo(float x, float y);
+		void LineTo(float x, float y);
+		void ArcTo(float x, float y, float i, float j, bool clockwise);
+		void Clear();
+
+		// The start of a segment is the end of the one before it. The first
+		// segment starts where it ends, wherever the ball happens to be. One
+		// past the last segment is where the path finishes.
+		ToolpathPoint GetStart(size_t index) const;
+
+		// Total length, arcs included
+		float Length() const;
+};
+
+// Signed angle swept by an arc starting at (startX, startY), positive for
+// counter clockwise. An arc that ends where it starts is a full circle.
+double ArcSweep(float startX, float startY, const ToolpathSegment & segment, double * radius, double * startAngle);
+
+// Length of one segment starting at (startX, startY)
+float SegmentLength(float startX, float startY, const ToolpathSegment & segment);
+
+// Appends the points of an arc, without its start point, no further than
+// maxChord apart. Lines and moves append just their end point.
+void FlattenSegment(float startX, float startY, const ToolpathSegment & segment, float maxChord, std::vector<ToolpathPoint> & points);
+
+#endif
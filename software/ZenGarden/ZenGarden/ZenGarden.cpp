@@ -47,8 +47,18 @@
 
 #include "stdafx.h"
 #include "Serial.h"
+#include "Timing.h"
+#include "Toolpath.h"
+#include "Coverage.h"
+#include "CommandRing.h"
+#include "HeapCounter.h"
+#include "PatternEngine.h"
+#include "StrokeOrder.h"
+#include "Placement.h"
+#include "Keyboard.h"
 #include <conio.h> // Keybord 
 #include <math.h>       /* cos */
+#include <time.h>
 
 #define SETTING_COM_PORT					3
 #define SETTING_COM_BAUDRATE				57600
@@ -57,10 +67,37 @@
 #define SETTING_TABLE_SIZE_X				SETTING_TABLE_SIZE 
 #define SETTING_TABLE_SIZE_Y				SETTING_TABLE_SIZE 
 
+// Patterns are drawn around (0, 0). This is where that goes on the table, how
+// much bigger they get and how far they turn, in degrees counter clockwise.
+#define SETTING_PLACEMENT_X					(SETTING_TABLE_SIZE_X / 2.0f)
+#define SETTING_PLACEMENT_Y					(SETTING_TABLE_SIZE_Y / 2.0f)
+#define SETTING_PLACEMENT_SCALE				1.0f
+#define SETTING_PLACEMENT_ROTATION			0.0f
+
+// Everything is clipped to stay this far inside the edge of the table
+#define SETTING_TABLE_MARGIN				5.0f
+
 #define SETTING_DELAY_COMMAND				10
 
+// Record all of the serial traffic to capture-YYYYMMDD-HHMMSS.zgc, replay it with ZenReplay
+#define SETTING_CAPTURE_ENABLED				1
+
 #define SETTING_MANUAL_MODE_STEP			5
 
+// Width of the groove the ball leaves in the sand
+#define SETTING_GROOVE_WIDTH				8.0f
+
+// Drop or shorten the segments that only retrace existing grooves
+#define SETTING_CULL_REDUNDANT				1
+
+// Reorder the strokes of a pattern to cut down the travel between them
+#define SETTING_OPTIMIZE_STROKE_ORDER		1
+#define SETTING_REVERSE_STROKES				1
+#define SETTING_STROKE_ORDER_BUDGET_US		2000000
+
+// Rough speed of the ball in mm per second, only used to estimate times
+#define SETTING_TRAVEL_SPEED				25.0f
+
 #define GCODE_G01_LINEAR_INTERPOLATION						"G01" 
 #define GCODE_G02_CIRCULAR_INTERPOLATION_CLOCKWISE			"G02" 
 #define GCODE_G03_CIRCULAR_INTERPOLATION_COUNTER_CLOCKWISE  "G03" 
@@ -69,139 +106,412 @@
 #define GCODE_G91_POSITION_REFERENCED						"G91" 
 
 
-#define SEND_BUFFER_MAX_LENGTH				1024 
 #define READ_BUFFER_MAX_LENGTH				1024
 
+// The plotter sends this when it finished a command
+#define PLOTTER_PROMPT						'>'
+
+// Commands sent before waiting for the plotter to finish one. With more than
+// one, several commands go out in a single write and the plotter buffers them.
+#define SETTING_COMMANDS_IN_FLIGHT			1
+
+// Real-time control bytes (Grbl style). The controller acts on these the moment
+// they arrive, they are never queued behind the G-code that is already buffered.
+#define REALTIME_FEED_HOLD			'!'
+#define REALTIME_CYCLE_RESUME		'~'
+#define REALTIME_SOFT_RESET			0x18
+
+// Warn if it takes longer than this from the key press to the stop byte leaving the host
+#define SETTING_STOP_LATENCY_MAX_US			50000
+
 #define STATE_RUNNING				1
 #define STATE_PAUSE					2
 #define STATE_SHUTDOWN				3
 
+// What the keyboard thread did about a key, the main thread follows it up
+#define KEY_ACTION_NONE				0
+#define KEY_ACTION_PAUSE			1
+#define KEY_ACTION_RESUME			2
+#define KEY_ACTION_QUIT				3
+
 int globalState;
 
+// Pause and quit keys, read on their own thread
+CKeyboard keyboard;
 
-class CPlotter
+
+class CPlotter : public CKeyListener
 {
 	private:
 
 		CSerial m_serial;
 
+		// Commands waiting to be sent and the ones the plotter is working on
+		CCommandRing m_commands;
+		unsigned long m_commandsSent;
+		unsigned long m_writes;
+
+		// The command that was executing when the last pause or quit happened
+		char m_interruptedCommand[COMMAND_MAX_LENGTH];
+		unsigned long m_interruptedCommandNumber;
+
+		// Stop latency, key press to the stop byte being handed to the serial driver
+		LONGLONG m_stopLatencyMax;
+		LONGLONG m_stopLatencyTotal;
+		int m_stopCount;
+
+		// What the controller has been told, only used on the keyboard thread
+		bool m_held;
+		bool m_stopped;
+
 	public:
+		CPlotter() {
+			this->m_commandsSent = 0;
+			this->m_writes = 0;
+			this->m_interruptedCommand[0] = 0;
+			this->m_interruptedCommandNumber = 0;
+			this->m_stopLatencyMax = 0;
+			this->m_stopLatencyTotal = 0;
+			this->m_stopCount = 0;
+			this->m_held = false;
+			this->m_stopped = false;
+		}
+
 		bool Open(int port, int baudrate) {
 			// Connect to the serial port 
 			if (!this->m_serial.Open(port, baudrate)) {
 				printf("Error: Could not open the serial port. port=%d, baudrate=%d\n", port, baudrate);
 				return false;
 			}
+			if (SETTING_CAPTURE_ENABLED) {
+				StartCapture();
+			}
+
+			// Wait for the plotter to say hello before sending anything
+			while (this->m_serial.ReadDataWaiting() <= 0) {
+				if (!checkUserInput()) {
+					return false;
+				}
+				Sleep(0); // Give some time back to the OS 
+			}
+			ReadIncomingBuffer();
+
 			return SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
 		}
 
 		void Close() {
 			printf("FYI: Disconnecting from plotter\n");
+			printf("FYI: Sent %lu commands in %lu writes\n", this->m_commandsSent, this->m_writes);
+			if (this->m_stopCount > 0) {
+				printf("FYI: Stop latency, count=%d, avg=%lldus, max=%lldus\n", this->m_stopCount, this->m_stopLatencyTotal / this->m_stopCount, this->m_stopLatencyMax);
+			}
 			this->m_serial.Close(); 
 		}
 
+		void StartCapture() {
+			time_t now = time(NULL);
+			struct tm local;
+			localtime_s(&local, &now);
+			char filename[64];
+			strftime(filename, sizeof(filename), "capture-%Y%m%d-%H%M%S.zgc", &local);
+			if (!this->m_serial.StartCapture(filename)) {
+				printf("Warning: Could not create the capture file. filename=[%s]\n", filename);
+				return;
+			}
+			printf("FYI: Capturing serial traffic to [%s]\n", filename);
+		}
+
 		bool Move(float x, float y) {
-			printf("FYI: Move X=[%.3f] Y=[%.3f]\n",x,y);
-			char sendBuffer[SEND_BUFFER_MAX_LENGTH];
-			sprintf_s(sendBuffer, SEND_BUFFER_MAX_LENGTH, "%s X%.3f Y%.3f", GCODE_G01_LINEAR_INTERPOLATION, x, y);
-			return SendCommand(sendBuffer); 
+			return QueueMove(x, y) && SendQueued();
 		}
 		bool Arc(float x, float y, float i, float j, char * command ) {
+			return QueueArc(x, y, i, j, command) && SendQueued();
+		}
+		bool SendCommand(char * command) {
+			return QueueCommand("%s", command) && SendQueued();
+		}
+
+		// Draws a whole toolpath. Stops early when the user quits.
+		bool Draw(const CToolpath & path) {
+			for (size_t index = 0; index < path.segments.size(); index++) {
+				const ToolpathSegment & segment = path.segments[index];
+				bool queued;
+				switch (segment.type) {
+					case TOOLPATH_ARC_CW: {
+						queued = QueueArc(segment.x, segment.y, segment.i, segment.j, GCODE_G02_CIRCULAR_INTERPOLATION_CLOCKWISE);
+						break;
+					}
+					case TOOLPATH_ARC_CCW: {
+						queued = QueueArc(segment.x, segment.y, segment.i, segment.j, GCODE_G03_CIRCULAR_INTERPOLATION_COUNTER_CLOCKWISE);
+						break;
+					}
+					default: {
+						queued = QueueMove(segment.x, segment.y);
+						break;
+					}
+				}
+				if (!queued) {
+					return false;
+				}
+				// Collect a full window of commands so they go out in one write
+				if (this->m_commands.GetUnsent() >= SETTING_COMMANDS_IN_FLIGHT && !SendQueued()) {
+					return false;
+				}
+			}
+			return SendQueued();
+		}
+
+		bool QueueMove(float x, float y) {
+			printf("FYI: Move X=[%.3f] Y=[%.3f]\n",x,y);
+			return QueueCommand("%s X%.3f Y%.3f", GCODE_G01_LINEAR_INTERPOLATION, x, y);
+		}
+		bool QueueArc(float x, float y, float i, float j, char * command) {
 			printf("FYI: Arc=[%s] X=[%.3f] Y=[%.3f] i=[%.3f] j=[%.3f]\n", command, x, y, i , j );
-			char sendBuffer[SEND_BUFFER_MAX_LENGTH];
-			sprintf_s(sendBuffer, SEND_BUFFER_MAX_LENGTH, "%s X%.3f Y%.3f I%.3f J%.3f", command, x, y, i ,j);
-			return SendCommand(sendBuffer);
+			return QueueCommand("%s X%.3f Y%.3f I%.3f J%.3f", command, x, y, i, j);
 		}
 
-		bool SendCommand(char * command)
-		{
-			ReadIncomingBuffer(); 
+		// Formats a command straight into the command ring. When the ring is
+		// full the queued commands are sent and finished to make room.
+		template <typename... Arguments>
+		bool QueueCommand(const char * format, Arguments... arguments) {
+			while (!this->m_commands.HasRoom()) {
+				if (!SendQueued() || !WaitForCommandsInFlight(this->m_commands.GetInFlight() - 1)) {
+					return false;
+				}
+			}
+			return this->m_commands.Format(format, arguments...);
+		}
 
-			printf("FYI: Sending Command: [%s]\n", command);
-			int length = strlen(command); 
-			if (this->m_serial.SendData(command, length) != length) {
-				printf("Error: Could not send message to plotter. length=%d, command=[%s]\n", length, command);
-				return false;
+		// Sends everything that is queued. As many commands as the plotter will
+		// take go out together, in a single write.
+		bool SendQueued() {
+			while (this->m_commands.GetUnsent() > 0) {
+				if (!WaitForCommandsInFlight(SETTING_COMMANDS_IN_FLIGHT - 1)) {
+					return false;
+				}
+				// Nothing new goes out while paused, and everything is dropped after a quit
+				if (!WaitWhilePaused()) {
+					return false;
+				}
+
+				const char * span;
+				int length;
+				int commands = this->m_commands.GetUnsentSpan(SETTING_COMMANDS_IN_FLIGHT - this->m_commands.GetInFlight(), &span, &length);
+				printf("FYI: Sending Command: [%.*s]\n", length - COMMAND_TERMINATOR_LENGTH, span);
+				int sent = this->m_serial.SendData(span, length);
+				if (sent != length) {
+					// Part of a line may already be with the plotter. Sending the span
+					// again would glue a full copy onto that part, so stop for good.
+					printf("Error: Could not send message to plotter. length=%d, sent=%d, command=[%.*s]\n", length, sent, length - COMMAND_TERMINATOR_LENGTH, span);
+					this->m_commands.Clear();
+					globalState = STATE_SHUTDOWN;
+					return false;
+				}
+				this->m_commands.MarkSent(commands);
+				this->m_commandsSent += commands;
+				this->m_writes++;
+				Sleep(SETTING_DELAY_COMMAND);
 			}
-			this->m_serial.SendData(";\n", 2);
-			Sleep(SETTING_DELAY_COMMAND);
 			return true;
 		}
 
-		void ReadIncomingBuffer() {
-			// Wait for last command to finish first
-			// This is indecated by reciving a ">" 			
-			while (this->m_serial.ReadDataWaiting() <= 0) {
+		// Reads the replies until no more than maxInFlight commands are still running
+		bool WaitForCommandsInFlight(int maxInFlight) {
+			while (this->m_commands.GetInFlight() > maxInFlight) {
+				ReadIncomingBuffer();
 				if (!checkUserInput()) {
-					return;
+					return false;
 				}
 				Sleep(0); // Give some time back to the OS 
 			}
-			// For debug, print out what we recived. 
+			return true;
+		}
+
+		// Prints whatever the plotter sent. Each prompt marks a finished command.
+		void ReadIncomingBuffer() {
 			char recvBuffer[READ_BUFFER_MAX_LENGTH];
-			do {
+			while (this->m_serial.ReadDataWaiting() > 0) {
 				int recvBufferLength = this->m_serial.ReadData(recvBuffer, READ_BUFFER_MAX_LENGTH);
-				if (recvBufferLength > 0) {
-					recvBuffer[recvBufferLength - 1] = 0;
-					printf("%s\n", recvBuffer);
+				if (recvBufferLength <= 0) {
+					return;
+				}
+				int prompts = 0;
+				for (int offset = 0; offset < recvBufferLength; offset++) {
+					if (recvBuffer[offset] == PLOTTER_PROMPT) {
+						prompts++;
+					}
 				}
+				this->m_commands.MarkDone(prompts);
+
+				// For debug, print out what we recived. 
+				recvBuffer[recvBufferLength - 1] = 0;
+				printf("%s\n", recvBuffer);
+			}
+		}
+
+
+		// Block while paused. Incoming data is still drained so the replies from
+		// the plotter are printed while the ball is held.
+		bool WaitWhilePaused() {
+			// Pick up a pause or quit that came in while we were busy
+			if (!checkUserInput()) {
+				return false;
+			}
+			while (globalState == STATE_PAUSE) {
+				ReadIncomingBuffer();
 				if (!checkUserInput()) {
-					return;
+					return false;
 				}
-			} while (this->m_serial.ReadDataWaiting() > 0);
-			
+				Sleep(1);
+			}
+			return (globalState != STATE_SHUTDOWN);
 		}
 
+		// Stop the ball where it is. The controller keeps its buffered commands
+		// so a resume continues the interrupted command without a gap.
+		bool FeedHold(LONGLONG requestedAt) {
+			if (!this->m_serial.SendImmediate(REALTIME_FEED_HOLD)) {
+				printf("Error: Could not send the feed hold to the plotter\n");
+				return false;
+			}
+			RecordStopLatency(requestedAt);
+			return true;
+		}
 
-		bool checkUserInput() {
-			if (globalState == STATE_SHUTDOWN) {
+		bool FeedResume() {
+			if (!this->m_serial.SendImmediate(REALTIME_CYCLE_RESUME)) {
+				printf("Error: Could not send the resume to the plotter\n");
 				return false;
 			}
-			if (!_kbhit()) {
-				return true;
+			return true;
+		}
+
+		// Stop the ball, throw away everything that has not been sent yet and
+		// reset the controller so nothing that is buffered gets executed.
+		// SendImmediate waits for the feed hold to leave before it sends the
+		// reset, the driver only takes one of them at a time.
+		void EmergencyStop(LONGLONG requestedAt) {
+			int discarded = this->m_serial.WriteDataWaiting();
+			this->m_serial.PurgeOutput();
+			bool stopped = this->m_serial.SendImmediate(REALTIME_FEED_HOLD);
+			if (stopped) {
+				RecordStopLatency(requestedAt);
 			}
-			char key = _getch();
-			if (key < 0) {
-				return true;
+			else {
+				printf("Error: Could not send the feed hold to the plotter\n");
+			}
+			if (!this->m_serial.SendImmediate(REALTIME_SOFT_RESET)) {
+				printf("Error: Could not send the reset to the plotter\n");
+			}
+			else if (!stopped) {
+				// The reset stops the ball too
+				RecordStopLatency(requestedAt);
+			}
+			printf("FYI: Discarded %d unsent bytes\n", discarded);
+		}
+
+		// The oldest command in flight is the one the plotter is executing
+		void RecordInterruptedCommand() {
+			int length;
+			const char * command = this->m_commands.GetOldestInFlight(&length, &this->m_interruptedCommandNumber);
+			if (command == NULL) {
+				this->m_interruptedCommand[0] = 0;
+				printf("FYI: No command was running\n");
+				return;
+			}
+			memcpy(this->m_interruptedCommand, command, length);
+			this->m_interruptedCommand[length] = 0;
+			printf("FYI: Interrupted command #%lu [%s]\n", this->m_interruptedCommandNumber, this->m_interruptedCommand);
+		}
+
+		void RecordStopLatency(LONGLONG requestedAt) {
+			LONGLONG latency = GetTimeMicroseconds() - requestedAt;
+			this->m_stopLatencyTotal += latency;
+			this->m_stopCount++;
+			if (latency > this->m_stopLatencyMax) {
+				this->m_stopLatencyMax = latency;
+			}
+			if (latency > SETTING_STOP_LATENCY_MAX_US) {
+				printf("Warning: Stop took %lldus, limit is %dus\n", latency, SETTING_STOP_LATENCY_MAX_US);
+			}
+			else {
+				printf("FYI: Stop latency %lldus\n", latency);
+			}
+		}
+
+		// Runs on the keyboard thread as soon as a key is pressed, the main
+		// thread can be busy for seconds. Only the real-time bytes go out from
+		// here, before anything is printed. The main thread changes the state and keeps the books when it
+		// gets the key from checkUserInput.
+		int KeyPressed(char key, LONGLONG pressedAt) {
+			if (key < 0 || this->m_stopped) {
+				return KEY_ACTION_NONE;
 			}
 			key = toupper(key);
 
 			switch (key)
 			{
 			case 'Q':
+				EmergencyStop(pressedAt);
 				printf("\n\n");
 				printf("FYI: !!!!!!!!!!!!!!!!!\n");
 				printf("FYI: !!     QUIT    !!\n");
 				printf("FYI: !!!!!!!!!!!!!!!!!\n");
 				printf("\n\n");
-				globalState = STATE_SHUTDOWN;
-				return false;
-				break;
+				this->m_stopped = true;
+				return KEY_ACTION_QUIT;
 			case 'P':
 			default:
-				if (globalState == STATE_RUNNING) {
+				if (!this->m_held) {
+					// Nothing new is sent while paused, even if the plotter missed the hold
+					FeedHold(pressedAt);
 					printf("\n\n");
 					printf("FYI: !!!!!!!!!!!!!!!!!\n");
 					printf("FYI: !!     PAUSE   !!\n");
 					printf("FYI: !!!!!!!!!!!!!!!!!\n");
 					printf("\n\n");
-					globalState = STATE_PAUSE;
-
-					while (globalState == STATE_PAUSE) {
-						if (!checkUserInput()) {
-							return false;
-						}
-						Sleep(0);
-					}
+					this->m_held = true;
+					return KEY_ACTION_PAUSE;
 				}
-				else {
-					printf("\n\n");
-					printf("FYI: !!!!!!!!!!!!!!!!!\n");
-					printf("FYI: !!   RUNNING   !!\n");
-					printf("FYI: !!!!!!!!!!!!!!!!!\n");
-					printf("\n\n");
-					globalState = STATE_RUNNING;
+				printf("\n\n");
+				printf("FYI: !!!!!!!!!!!!!!!!!\n");
+				printf("FYI: !!   RUNNING   !!\n");
+				printf("FYI: !!!!!!!!!!!!!!!!!\n");
+				printf("\n\n");
+				// Stay paused if the plotter never got the resume, the next key tries again
+				if (!FeedResume()) {
+					return KEY_ACTION_NONE;
 				}
+				this->m_held = false;
+				return KEY_ACTION_RESUME;
+			}
+		}
+
+		bool checkUserInput() {
+			if (globalState == STATE_SHUTDOWN) {
+				return false;
+			}
+			char key;
+			int action;
+			if (!keyboard.GetKey(&key, &action)) {
+				return true;
+			}
+
+			switch (action)
+			{
+			case KEY_ACTION_QUIT:
+				RecordInterruptedCommand();
+				printf("FYI: Discarded %d queued commands\n", this->m_commands.GetUnsent());
+				this->m_commands.Clear();
+				globalState = STATE_SHUTDOWN;
+				return false;
+			case KEY_ACTION_PAUSE:
+				RecordInterruptedCommand();
+				globalState = STATE_PAUSE;
+				break;
+			case KEY_ACTION_RESUME:
+				printf("FYI: Resuming command #%lu [%s]\n", this->m_interruptedCommandNumber, this->m_interruptedCommand);
+				globalState = STATE_RUNNING;
 				break;
 			}
 			return true;
@@ -234,15 +544,6 @@ void PatternGoToCenter() {
 	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
 	plotter.Move(SETTING_TABLE_SIZE_X / 2, SETTING_TABLE_SIZE_Y / 2);
 }
-void PatternBorder() {
-	// Go to center
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-	plotter.Move(10, 10); // Bottom right 
-	plotter.Move(SETTING_TABLE_SIZE_X , 10); // Bottom left 
-	plotter.Move(SETTING_TABLE_SIZE_X, SETTING_TABLE_SIZE_Y); // Top left 
-	plotter.Move(10, SETTING_TABLE_SIZE_Y); // Top right 
-	plotter.Move(10, 10); // Bottom right 
-}
 
 
 void PatternBoxToCenter() {
@@ -264,59 +565,6 @@ void PatternBoxToCenter() {
 }
 
 
-void PatternRandomeLines() {
-	printf("FYI: PatternRandomeLines\n");
-
-	int borderOffset = 10; 
-
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-	bool done = false;
-	while (!done) {
-		if (_kbhit()) {
-			done = true; 
-			break; 
-		}
-		float x = (rand() % (SETTING_TABLE_SIZE_X - borderOffset)) + borderOffset;
-		float y = (rand() % (SETTING_TABLE_SIZE_X - borderOffset)) + borderOffset;
-		// Move some where randomly 
-		plotter.Move(x, y);
-
-		printf("FYI: Press any key to stop\n");
-	}
-}
-
-void PatternStar() {
-	printf("FYI: PatternStar\n");
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-
-	int setting_border_offset = 10;
-	int setting_step = 50;
-	int box_size = ((SETTING_TABLE_SIZE_X > SETTING_TABLE_SIZE_Y) ? SETTING_TABLE_SIZE_Y : SETTING_TABLE_SIZE_X);
-
-	// X Pattern 		
-	for (int offset = setting_step; offset < box_size; offset += setting_step) {
-		plotter.Move(offset, setting_border_offset);
-		plotter.Move(offset+ setting_border_offset, setting_border_offset);
-		plotter.Move(SETTING_TABLE_SIZE_X - offset, SETTING_TABLE_SIZE_Y- setting_border_offset);
-		plotter.Move(SETTING_TABLE_SIZE_X - offset - setting_border_offset, SETTING_TABLE_SIZE_Y - setting_border_offset);
-
-		printf("FYI: %d of %d Loops \n", (box_size - offset) / setting_step, box_size / setting_step);
-	}
-
-	// Y Pattern 
-	for (int offset = box_size; offset > 0; offset -= setting_step) {
-		plotter.Move(setting_border_offset, offset);
-		plotter.Move(setting_border_offset, offset + setting_border_offset);
-		plotter.Move(SETTING_TABLE_SIZE_X - setting_border_offset, SETTING_TABLE_SIZE_Y - offset);
-		plotter.Move(SETTING_TABLE_SIZE_X - setting_border_offset, SETTING_TABLE_SIZE_Y - offset - setting_border_offset);
-
-		printf("FYI: %d of %d Loops \n", (box_size - offset) / setting_step, box_size / setting_step);
-	}
-	printf("FYI: Done");
-}
-
-
-
 void ManualMode() {
 	printf("FYI: Entering Manual Mode\n");
 	plotter.SendCommand(GCODE_G91_POSITION_REFERENCED);
@@ -370,7 +618,7 @@ void ManualMode() {
 				break;
 			}
 			case '3': { // 
-				PatternBorder();
+				RunPattern(PatternBorder);
 				break;
 			}
 			case '4': { // 
@@ -378,7 +626,7 @@ void ManualMode() {
 				break;
 			}
 			case '5': { // 
-				PatternStar();
+				RunPattern(PatternStar);
 				break;
 			}
 			case '6': { // 
@@ -386,7 +634,7 @@ void ManualMode() {
 				break;
 			}
 			case '7': { // 
-				PatternRandomeLines();
+				RunPattern(PatternRandomeLines);
 				break;
 			}		  
 					  
@@ -424,13 +672,12 @@ void PrintHelp() {
 // ----------------------------------------------------------------------------
 
 
-void PatternStarOutFromCenterRandom() {
+void PatternStarOutFromCenterRandom(CToolpath & path) {
 	printf("FYI: PatternStarOutFromCenterRandom\n");
 
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-	plotter.Move(0, 0);
+	path.MoveTo(0, 0);
 
-	int radius = SETTING_TABLE_SIZE / 2;
+	float radius = SETTING_TABLE_SIZE / 2 - SETTING_TABLE_MARGIN;
 	int i = 0;
 	for (int iterations = 0; iterations < 20; iterations++)
 	{		
@@ -438,72 +685,54 @@ void PatternStarOutFromCenterRandom() {
 			i - 360;
 		}
 		i += 360/2-30;
-		if (!plotter.checkUserInput()) {
-			return;
-		}
 		float angle = i * (2 * 3.14) / 360;
 		float Xpos = (cos(angle) * radius);
 		float Ypos = (sin(angle) * radius);
-		plotter.Move(Xpos, Ypos);
+		path.LineTo(Xpos, Ypos);
 	}
 
-	plotter.Move(0, 0);
-	printf("Done\n");
+	path.LineTo(0, 0);
 }
 
 
-void PatternStarOutFromCenter() {
+void PatternStarOutFromCenter(CToolpath & path) {
 	printf("FYI: PatternStarOutFromCenter\n");
 
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-	plotter.Move(0, 0);
+	path.MoveTo(0, 0);
 
-	int radius = SETTING_TABLE_SIZE / 2; 
+	float radius = SETTING_TABLE_SIZE / 2 - SETTING_TABLE_MARGIN;
 
 	for (int i = 0; i < 360; i += 10)
 	{
-		if (!plotter.checkUserInput()) {
-			return;
-		}
 		float angle = i * (2 * 3.14) / 360;
 		float Xpos = (cos(angle) * radius);
 		float Ypos = (sin(angle) * radius);
-		plotter.Move(Xpos, Ypos);
-		plotter.Move(0, 0);
+		path.LineTo(Xpos, Ypos);
+		path.LineTo(0, 0);
 	}
-	
-
-	printf("Done\n");
 }
 
 
-void PatternCircleOutFromCenter() {
+void PatternCircleOutFromCenter(CToolpath & path) {
 	printf("FYI: PatternCircleOutFromCenter\n");
 
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-	plotter.Move(0, 0);
+	path.MoveTo(0, 0);
 
 	for (int radius = 10; radius < SETTING_TABLE_SIZE/2; radius += 10) {
 		for (int i = 0; i < 360; i += 20)
 		{
-			if (!plotter.checkUserInput()) {
-				return; 
-			}
 			float angle = i * (2 * 3.14) / 360;
 			float Xpos = (cos(angle) * radius);
 			float Ypos = (sin(angle) * radius);
-			plotter.Move(Xpos, Ypos);
+			path.LineTo(Xpos, Ypos);
 		}
 	}
-
-	printf("Done\n");
 }
 
-void PatternBoxFromCenter() {
+void PatternBoxFromCenter(CToolpath & path) {
 	printf("FYI: PatternBoxToCenter\n");
 
-	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
-	plotter.Move(0, 0);
+	path.MoveTo(0, 0);
 
 	int maxBoxSize = SETTING_TABLE_SIZE; // Max size 
 
@@ -514,12 +743,7 @@ void PatternBoxFromCenter() {
 	int t = maxBoxSize;
 	int maxI = t*t;
 	for (int i = 0; i < maxI; i+=1) {
-		if (!plotter.checkUserInput()) {
-			return;
-		}
-		if ((-maxBoxSize / 2 <= x) && (x <= maxBoxSize / 2) && (-maxBoxSize / 2 <= y) && (y <= maxBoxSize / 2)) {
-			plotter.Move(x, y);			
-		}
+		path.LineTo(x, y);
 		if ((x == y) || ((x < 0) && (x == -y)) || ((x > 0) && (x == 1 - y))) {
 			t = dx;
 			dx = -dy;
@@ -529,29 +753,186 @@ void PatternBoxFromCenter() {
 		y += dy;
 	}
 
-	plotter.Move(0, 0);
+	path.LineTo(0, 0);
+}
+
+void PatternBorder(CToolpath & path) {
+	printf("FYI: PatternBorder\n");
+
+	float borderOffset = 10;
+	float halfX = SETTING_TABLE_SIZE_X / 2.0f - borderOffset;
+	float halfY = SETTING_TABLE_SIZE_Y / 2.0f - borderOffset;
+
+	path.MoveTo(-halfX, -halfY); // Bottom right 
+	path.LineTo(halfX, -halfY); // Bottom left 
+	path.LineTo(halfX, halfY); // Top left 
+	path.LineTo(-halfX, halfY); // Top right 
+	path.LineTo(-halfX, -halfY); // Bottom right 
+}
+
+void PatternRandomeLines(CToolpath & path) {
+	printf("FYI: PatternRandomeLines\n");
+
+	int borderOffset = 10; 
+	int lineCount = 200;
+	float halfX = SETTING_TABLE_SIZE_X / 2.0f;
+	float halfY = SETTING_TABLE_SIZE_Y / 2.0f;
+
+	path.MoveTo(0, 0);
+	for (int line = 0; line < lineCount; line++) {
+		// A line some where randomly 
+		float x = (rand() % (SETTING_TABLE_SIZE_X - 2 * borderOffset)) + borderOffset - halfX;
+		float y = (rand() % (SETTING_TABLE_SIZE_Y - 2 * borderOffset)) + borderOffset - halfY;
+		path.MoveTo(x, y);
+		x = (rand() % (SETTING_TABLE_SIZE_X - 2 * borderOffset)) + borderOffset - halfX;
+		y = (rand() % (SETTING_TABLE_SIZE_Y - 2 * borderOffset)) + borderOffset - halfY;
+		path.LineTo(x, y);
+	}
+}
+
+void PatternStar(CToolpath & path) {
+	printf("FYI: PatternStar\n");
+
+	int setting_border_offset = 10;
+	int setting_step = 50;
+	int box_size = ((SETTING_TABLE_SIZE_X > SETTING_TABLE_SIZE_Y) ? SETTING_TABLE_SIZE_Y : SETTING_TABLE_SIZE_X);
+
+	// Corners of the table, around the centre
+	float left = -SETTING_TABLE_SIZE_X / 2.0f;
+	float right = SETTING_TABLE_SIZE_X / 2.0f;
+	float bottom = -SETTING_TABLE_SIZE_Y / 2.0f;
+	float top = SETTING_TABLE_SIZE_Y / 2.0f;
+
+	path.MoveTo(0, 0);
+
+	// X Pattern 		
+	for (int offset = setting_step; offset < box_size; offset += setting_step) {
+		path.MoveTo(left + offset, bottom + setting_border_offset);
+		path.LineTo(left + offset + setting_border_offset, bottom + setting_border_offset);
+		path.LineTo(right - offset, top - setting_border_offset);
+		path.LineTo(right - offset - setting_border_offset, top - setting_border_offset);
+	}
+
+	// Y Pattern 
+	for (int offset = box_size; offset > 0; offset -= setting_step) {
+		path.MoveTo(left + setting_border_offset, bottom + offset);
+		path.LineTo(left + setting_border_offset, bottom + offset + setting_border_offset);
+		path.LineTo(right - setting_border_offset, top - offset);
+		path.LineTo(right - setting_border_offset, top - offset - setting_border_offset);
+	}
+}
+
+// Shared by the generative patterns, its threads are started the first time it is used
+CPatternEngine & GetPatternEngine() {
+	static CPatternEngine engine;
+	return engine;
+}
+
+void PatternSpirograph(CToolpath & path) {
+	printf("FYI: PatternSpirograph\n");
+	GetPatternEngine().Generate(CPatternEngine::DefaultDesign(GENERATIVE_HYPOTROCHOID, SETTING_TABLE_SIZE / 2 - SETTING_TABLE_MARGIN), path);
+}
+
+void PatternLissajous(CToolpath & path) {
+	printf("FYI: PatternLissajous\n");
+	GetPatternEngine().Generate(CPatternEngine::DefaultDesign(GENERATIVE_LISSAJOUS, SETTING_TABLE_SIZE / 2 - SETTING_TABLE_MARGIN), path);
+}
+
+void PatternRose(CToolpath & path) {
+	printf("FYI: PatternRose\n");
+	GetPatternEngine().Generate(CPatternEngine::DefaultDesign(GENERATIVE_ROSE, SETTING_TABLE_SIZE / 2 - SETTING_TABLE_MARGIN), path);
+}
+
+void PatternFlowField(CToolpath & path) {
+	printf("FYI: PatternFlowField\n");
+	GetPatternEngine().Generate(CPatternEngine::DefaultDesign(GENERATIVE_FLOW_FIELD, SETTING_TABLE_SIZE / 2 - SETTING_TABLE_MARGIN), path);
+}
+
+// Builds a pattern, reports how much of it retraces existing grooves and draws it
+bool RunPattern(void (*pattern)(CToolpath & path)) {
+	// Kept from one pattern to the next so their storage is reused
+	static CToolpath path;
+	static CToolpath clipped;
+	static CToolpath ordered;
+	static CToolpath culled;
+	static CStrokeOptimizer strokeOptimizer;
+	static CCoverageAnalyzer coverageAnalyzer;
+	if (globalState == STATE_SHUTDOWN) {
+		return false;
+	}
+	unsigned long long heapAllocations = GetHeapAllocations();
+
+	path.Clear();
+	pattern(path);
+
+	// From pattern coordinates to the table, and never past its edge
+	Placement placement = { SETTING_PLACEMENT_X, SETTING_PLACEMENT_Y, SETTING_PLACEMENT_SCALE, SETTING_PLACEMENT_ROTATION };
+	PlaceToolpath(path, placement);
+	ClipBounds bounds = { SETTING_TABLE_MARGIN, SETTING_TABLE_MARGIN, SETTING_TABLE_SIZE_X - SETTING_TABLE_MARGIN, SETTING_TABLE_SIZE_Y - SETTING_TABLE_MARGIN };
+	ClipReport clip;
+	ClipToolpath(path, bounds, clipped, &clip);
+	if (clip.clippedSegments > 0 || clip.removedSegments > 0) {
+		printf("Warning: Pattern goes past the edge of the table, %u segments clipped, %u removed\n", (unsigned int)clip.clippedSegments, (unsigned int)clip.removedSegments);
+	}
+	path.segments.swap(clipped.segments);
+
+	if (SETTING_OPTIMIZE_STROKE_ORDER) {
+		StrokeOrderReport order;
+		strokeOptimizer.Optimize(path, SETTING_REVERSE_STROKES != 0, SETTING_STROKE_ORDER_BUDGET_US, &order, ordered);
+		if (order.strokes > 1) {
+			printf("FYI: Stroke order, %u strokes, %u reversed, travel %.0f => %.0f, saves about %.1fs (%lldms%s)\n", (unsigned int)order.strokes, (unsigned int)order.reversedStrokes, 
+				order.travelBefore, order.travelAfter, (order.travelBefore - order.travelAfter) / SETTING_TRAVEL_SPEED, order.elapsedUs / 1000, order.outOfTime ? ", out of time" : "");
+		}
+		path.segments.swap(ordered.segments);
+	}
+
+	CoverageReport coverage;
+	coverageAnalyzer.Analyze(path, SETTING_GROOVE_WIDTH, &coverage, SETTING_CULL_REDUNDANT ? &culled : NULL);
+	printf("FYI: Overdraw %.1f%%, %u of %u segments only retrace existing grooves\n", coverage.overdrawPercent, (unsigned int)coverage.redundantSegments, (unsigned int)coverage.segments);
+	if (SETTING_CULL_REDUNDANT) {
+		printf("FYI: Culled %u segments, length %.0f => %.0f\n", (unsigned int)coverage.culledSegments, coverage.length, coverage.culledLength);
+		path.segments.swap(culled.segments);
+	}
+
+	plotter.SendCommand(GCODE_G90_ABSOLUTE_PROGRAMMING);
+	if (!plotter.Draw(path)) {
+		return false;
+	}
+	printf("FYI: Heap allocations %llu\n", GetHeapAllocations() - heapAllocations);
+	printf("Done\n");
+	return true;
 }
 
 
 int main()
 {
 	PrintHelp();	
+
+	// Running from the start, so a pause while connecting holds the first command
+	globalState = STATE_RUNNING; 
+	keyboard.Start(&plotter);
 	
 	if (!plotter.Open(SETTING_COM_PORT, SETTING_COM_BAUDRATE)) {
 		printf("Error: Could not connect to the plotter");
+		keyboard.Stop();
 		return 1;
 	}
 
 
 
 	// Loop in demo mode 
-	globalState = STATE_RUNNING; 
-	while (globalState == STATE_RUNNING )
+	while (globalState != STATE_SHUTDOWN )
 	{
-		PatternStarOutFromCenterRandom(); 
-		PatternCircleOutFromCenter();
-		PatternStarOutFromCenter(); 
-		PatternCircleOutFromCenter();
+		RunPattern(PatternStarOutFromCenterRandom); 
+		RunPattern(PatternCircleOutFromCenter);
+		RunPattern(PatternStarOutFromCenter); 
+		RunPattern(PatternCircleOutFromCenter);
+		RunPattern(PatternSpirograph);
+		RunPattern(PatternLissajous);
+		RunPattern(PatternRose);
+		RunPattern(PatternFlowField);
+		RunPattern(PatternStar);
+		RunPattern(PatternRandomeLines);
 	}
 		
 	// Find home. 
@@ -561,6 +942,8 @@ int main()
 	// Wait on use key.
 	//ManualMode();
 	
+	// The keyboard thread uses the plotter, stop it first
+	keyboard.Stop();
 	plotter.Close(); 
     return 0;
 }
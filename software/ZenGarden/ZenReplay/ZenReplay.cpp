@@ -0,0 +1,297 @@
+/**
+ * ZenReplay
+ * https://github.com/funvill/ZenGarden
+ *
+ * Plays the controller side of a serial session that was recorded by ZenGarden
+ * (see SerialCapture.h). Connect ZenGarden to one end of a virtual null modem
+ * pair (com0com or similar) and point ZenReplay at the other end. Windows has
+ * no pseudo-terminals, the null modem pair takes their place.
+ *
+ * Every reply the controller made in the recording is sent back after the
+ * host has sent the same number of command lines, delayed by the same amount
+ * of time the real controller took. The host under test sees the timing of
+ * the original table and both sessions can be compared.
+ *
+ * Usage
+ *   ZenReplay capture.zgc                 Print the statistics of a capture
+ *   ZenReplay capture.zgc port [baud]     Replay a capture on COM<port>
+ */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Serial.h"
+#include "Timing.h"
+#include "SerialCapture.h"
+
+#define SETTING_COM_BAUDRATE				57600
+
+// Give up when the host has not sent the next command line for this long
+#define SETTING_REPLAY_TIMEOUT_US			10000000
+
+// Number of recent command line times kept for the live host
+#define LINE_TIME_HISTORY					256
+
+#define READ_BUFFER_MAX_LENGTH				1024
+
+struct SessionStats
+{
+	LONGLONG firstTime;
+	LONGLONG lastTime;
+	unsigned long lines;
+	unsigned long long bytesSent;
+	unsigned long long bytesReceived;
+
+	// Time from a controller reply to the end of the next host write
+	unsigned long turnarounds;
+	LONGLONG turnaroundTotal;
+	LONGLONG turnaroundMax;
+};
+
+void ResetStats(SessionStats * stats) {
+	memset(stats, 0, sizeof(SessionStats));
+	stats->firstTime = -1;
+}
+
+void AddTurnaround(SessionStats * stats, LONGLONG turnaround) {
+	stats->turnarounds++;
+	stats->turnaroundTotal += turnaround;
+	if (turnaround > stats->turnaroundMax) {
+		stats->turnaroundMax = turnaround;
+	}
+}
+
+void PrintStats(const char * name, SessionStats * stats) {
+	double duration = (stats->firstTime < 0) ? 0.0 : (stats->lastTime - stats->firstTime) / 1000000.0;
+	printf("%s\n", name);
+	printf("  Duration:         %.3f s\n", duration);
+	printf("  Command lines:    %lu\n", stats->lines);
+	printf("  Bytes sent:       %llu\n", stats->bytesSent);
+	printf("  Bytes received:   %llu\n", stats->bytesReceived);
+	if (duration > 0.0) {
+		printf("  Throughput:       %.2f lines/s\n", stats->lines / duration);
+	}
+	if (stats->turnarounds > 0) {
+		printf("  Host turnaround:  avg=%lldus, max=%lldus\n", stats->turnaroundTotal / stats->turnarounds, stats->turnaroundMax);
+	}
+}
+
+int CountLines(const char * buffer, int length) {
+	int lines = 0;
+	for (int offset = 0; offset < length; offset++) {
+		if (buffer[offset] == '\n') {
+			lines++;
+		}
+	}
+	return lines;
+}
+
+// Statistics of the recorded session, without touching a serial port
+bool ReadCaptureStats(const char * filename, SessionStats * stats) {
+	CSerialCapture capture;
+	if (!capture.OpenForReading(filename)) {
+		printf("Error: Could not read the capture. filename=[%s]\n", filename);
+		return false;
+	}
+
+	ResetStats(stats);
+	static CaptureRecord record;
+	int previousDirection = 0;
+	LONGLONG previousTime = 0;
+	while (capture.ReadRecord(&record)) {
+		if (stats->firstTime < 0) {
+			stats->firstTime = record.llTime;
+		}
+		stats->lastTime = record.llTime;
+
+		if (record.nDirection == CAPTURE_SENT || record.nDirection == CAPTURE_SENT_IMMEDIATE) {
+			if (previousDirection == CAPTURE_RECEIVED) {
+				AddTurnaround(stats, record.llTime - previousTime);
+			}
+			stats->bytesSent += record.nLength;
+			stats->lines += CountLines(record.data, record.nLength);
+		}
+		else if (record.nDirection == CAPTURE_RECEIVED) {
+			stats->bytesReceived += record.nLength;
+		}
+		previousDirection = record.nDirection;
+		previousTime = record.llTime;
+	}
+	return true;
+}
+
+class CReplay
+{
+	private:
+		CSerial m_serial;
+		SessionStats m_live;
+
+		// When the live host finished each of its recent command lines
+		LONGLONG m_lineTime[LINE_TIME_HISTORY];
+		bool m_waitingForHost;
+		LONGLONG m_lastReplyTime;
+
+		// Read whatever the host has sent and keep track of its command lines
+		void PumpHost() {
+			char recvBuffer[READ_BUFFER_MAX_LENGTH];
+			while (this->m_serial.ReadDataWaiting() > 0) {
+				int recvBufferLength = this->m_serial.ReadData(recvBuffer, READ_BUFFER_MAX_LENGTH);
+				if (recvBufferLength <= 0) {
+					return;
+				}
+				LONGLONG now = GetTimeMicroseconds();
+				if (this->m_live.firstTime < 0) {
+					this->m_live.firstTime = now;
+				}
+				this->m_live.lastTime = now;
+				this->m_live.bytesSent += recvBufferLength;
+				for (int offset = 0; offset < recvBufferLength; offset++) {
+					if (recvBuffer[offset] == '\n') {
+						// The recording times a host write when it ends, a line is
+						// only complete once its '\n' is here
+						if (this->m_waitingForHost) {
+							AddTurnaround(&this->m_live, now - this->m_lastReplyTime);
+							this->m_waitingForHost = false;
+						}
+						this->m_live.lines++;
+						this->m_lineTime[this->m_live.lines % LINE_TIME_HISTORY] = now;
+					}
+				}
+			}
+		}
+
+		// Wait until the host has sent at least this many command lines
+		bool WaitForLines(unsigned long lines) {
+			LONGLONG waitStart = GetTimeMicroseconds();
+			while (this->m_live.lines < lines) {
+				PumpHost();
+				if (GetTimeMicroseconds() - waitStart > SETTING_REPLAY_TIMEOUT_US) {
+					printf("Error: The host stopped sending. Expected %lu lines, got %lu\n", lines, this->m_live.lines);
+					return false;
+				}
+				Sleep(0); // Give some time back to the OS
+			}
+			return true;
+		}
+
+		void WaitUntil(LONGLONG when) {
+			while (GetTimeMicroseconds() < when) {
+				PumpHost();
+				Sleep(0);
+			}
+		}
+
+	public:
+		bool Open(int port, int baudrate) {
+			if (!this->m_serial.Open(port, baudrate)) {
+				printf("Error: Could not open the serial port. port=%d, baudrate=%d\n", port, baudrate);
+				return false;
+			}
+			return true;
+		}
+
+		void Close() {
+			this->m_serial.Close();
+		}
+
+		SessionStats * GetStats() {
+			return &this->m_live;
+		}
+
+		bool Replay(const char * filename) {
+			CSerialCapture capture;
+			if (!capture.OpenForReading(filename)) {
+				printf("Error: Could not read the capture. filename=[%s]\n", filename);
+				return false;
+			}
+
+			ResetStats(&this->m_live);
+			memset(this->m_lineTime, 0, sizeof(this->m_lineTime));
+			this->m_waitingForHost = false;
+			this->m_lastReplyTime = 0;
+
+			// Recorded time the host finished its latest command line
+			unsigned long recordedLines = 0;
+			LONGLONG recordedLineTime = 0;
+			LONGLONG sessionStart = GetTimeMicroseconds();
+
+			printf("FYI: Waiting for the host\n");
+			static CaptureRecord record;
+			while (capture.ReadRecord(&record)) {
+				switch (record.nDirection) {
+					case CAPTURE_SENT: {
+						int lines = CountLines(record.data, record.nLength);
+						if (lines > 0) {
+							recordedLines += lines;
+							recordedLineTime = record.llTime;
+						}
+						break;
+					}
+					case CAPTURE_RECEIVED: {
+						// Reply relative to the host line that caused it
+						if (!WaitForLines(recordedLines)) {
+							return false;
+						}
+						if (recordedLines > 0 && this->m_live.lines - recordedLines >= LINE_TIME_HISTORY) {
+							printf("Warning: The host is %lu lines ahead of the recording\n", this->m_live.lines - recordedLines);
+						}
+						LONGLONG anchor = (recordedLines == 0) ? sessionStart : this->m_lineTime[recordedLines % LINE_TIME_HISTORY];
+						WaitUntil(anchor + (record.llTime - recordedLineTime));
+
+						this->m_serial.SendData(record.data, record.nLength);
+						this->m_lastReplyTime = GetTimeMicroseconds();
+						this->m_waitingForHost = true;
+						this->m_live.bytesReceived += record.nLength;
+						this->m_live.lastTime = this->m_lastReplyTime;
+						break;
+					}
+					default: {
+						// Real-time bytes and purges are host side events, nothing to play back
+						break;
+					}
+				}
+			}
+			printf("FYI: End of the capture\n");
+			return true;
+		}
+};
+
+
+int main(int argc, char * argv[])
+{
+	if (argc < 2) {
+		printf("Usage: ZenReplay capture.zgc [port] [baud]\n");
+		return 1;
+	}
+	const char * filename = argv[1];
+
+	SessionStats recorded;
+	if (!ReadCaptureStats(filename, &recorded)) {
+		return 1;
+	}
+	if (argc < 3) {
+		PrintStats("Recorded session", &recorded);
+		return 0;
+	}
+
+	int port = atoi(argv[2]);
+	int baudrate = (argc > 3) ? atoi(argv[3]) : SETTING_COM_BAUDRATE;
+
+	CReplay replay;
+	if (!replay.Open(port, baudrate)) {
+		return 1;
+	}
+	bool completed = replay.Replay(filename);
+	replay.Close();
+
+	PrintStats("Recorded session", &recorded);
+	PrintStats(completed ? "Replayed session" : "Replayed session (incomplete)", replay.GetStats());
+
+	SessionStats * live = replay.GetStats();
+	if (recorded.lastTime > recorded.firstTime && live->lastTime > live->firstTime) {
+		double recordedDuration = (recorded.lastTime - recorded.firstTime) / 1000000.0;
+		double liveDuration = (live->lastTime - live->firstTime) / 1000000.0;
+		printf("Change in duration: %+.1f%%\n", (liveDuration - recordedDuration) * 100.0 / recordedDuration);
+	}
+	return completed ? 0 : 1;
+}